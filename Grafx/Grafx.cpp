@@ -202,7 +202,9 @@ bool Grafx::loop(unsigned int iterations) {
 
     joinables.join_all();
     //		joinable = tq.exec(true);
-    joinables.add(tq.exec(true));
+    joinables.add(tq.exec(std::chrono::steady_clock::now() +
+                              std::chrono::milliseconds(16),
+                          true));
 
     if (update) {
       sf::Image img;
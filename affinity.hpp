@@ -0,0 +1,34 @@
+// === (C) 2020-2024 === parallel_f / affinity (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <cstdint>
+
+namespace parallel_f {
+
+// parallel_f :: affinity == implementation
+
+/*
+ * Key of the data a task works on, e.g. an object pointer or an id.
+ *
+ * Normal priority vthreads with the same key are queued for the worker which
+ * ran that key last, so its caches stay warm. Other workers only take them if
+ * that worker is idle or falling behind, see vthread::executor::schedule().
+ */
+class affinity {
+public:
+  uint64_t key; // zero for none
+
+  affinity() : key(0) {}
+
+  explicit affinity(uint64_t id) : key(id) {}
+
+  explicit affinity(const void *p) : key((uint64_t)(uintptr_t)p) {}
+
+  explicit operator bool() const { return key != 0; }
+
+  bool operator==(const affinity &other) const { return key == other.key; }
+};
+
+} // namespace parallel_f
@@ -0,0 +1,238 @@
+// === (C) 2020-2024 === parallel_f / budget (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+namespace parallel_f {
+
+// parallel_f :: budget == implementation
+
+/*
+ * Process wide CPU budget, one token per CPU the process may use, shared by all
+ * threads parallel_f runs: the workers of every executor, task_cl queue threads
+ * and helpers like the log flush thread.
+ *
+ * Threads that are optional, like additional workers, only start with a token
+ * from try_acquire(). Threads needed for progress take one with acquire() in any
+ * case, which counts as oversubscription when none is left. The stats show the
+ * peak use and the oversubscribed grants.
+ *
+ * Without dependencies on purpose, the log flush thread in system.hpp uses it.
+ */
+class budget {
+private:
+  std::atomic<int> capacity_;
+  std::atomic<int> used;
+  std::atomic<int> peak;
+  std::atomic<unsigned int> over;
+
+public:
+  /* never destroyed, helper threads may end during static destruction */
+  static budget &instance() {
+    static budget *budget_instance = new budget();
+
+    return *budget_instance;
+  }
+
+  budget() : capacity_(0), used(0), peak(0), over(0) {
+    capacity_ = (int)std::max(1u, default_capacity());
+  }
+
+  budget(const budget &) = delete;
+  budget &operator=(const budget &) = delete;
+
+  int capacity() const { return capacity_.load(std::memory_order_relaxed); }
+
+  void set_capacity(unsigned int n) { capacity_ = (int)std::max(1u, n); }
+
+  int in_use() const { return used.load(std::memory_order_relaxed); }
+
+  /* a token if one is left */
+  bool try_acquire() {
+    int u = used.load(std::memory_order_relaxed);
+
+    do {
+      if (u >= capacity())
+        return false;
+    } while (!used.compare_exchange_weak(u, u + 1, std::memory_order_relaxed));
+
+    track(u + 1);
+
+    return true;
+  }
+
+  /* a token in any case, for threads needed for progress */
+  void acquire() {
+    int u = used.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    if (u > capacity())
+      over.fetch_add(1, std::memory_order_relaxed);
+
+    track(u);
+  }
+
+  void release() { used.fetch_sub(1, std::memory_order_relaxed); }
+
+  /* peak use and grants beyond the capacity since the last call */
+  void take_stats(int &peak_used, unsigned int &oversubscribed) {
+    peak_used = peak.exchange(in_use());
+    oversubscribed = over.exchange(0);
+  }
+
+  /*
+   * CPUs granted by the cgroup CPU quota of the process, rounded up, zero for no
+   * quota. Looks at cpu.max (cgroup v2) or cpu.cfs_quota_us (v1) of the process'
+   * cgroup and its parents, the lowest limit applies.
+   */
+  static unsigned int cpu_quota() {
+#ifdef __linux__
+    std::ifstream f("/proc/self/cgroup");
+    std::string line;
+    double cpus = 0.0;
+
+    /* "0::/path" for v2, "N:cpu,cpuacct:/path" for v1 */
+    while (std::getline(f, line)) {
+      size_t a = line.find(':');
+      size_t b = line.find(':', a + 1);
+
+      if (a == std::string::npos || b == std::string::npos)
+        continue;
+
+      std::string controllers = line.substr(a + 1, b - a - 1);
+      std::string path = line.substr(b + 1);
+
+      if (controllers.empty()) {
+        cpus = lowest(cpus, quota_of("/sys/fs/cgroup", path, false));
+        continue;
+      }
+
+      std::stringstream ss(controllers);
+      std::string controller;
+
+      while (std::getline(ss, controller, ',')) {
+        if (controller != "cpu")
+          continue;
+
+        cpus = lowest(cpus, quota_of("/sys/fs/cgroup/" + controllers, path, true));
+        cpus = lowest(cpus, quota_of("/sys/fs/cgroup/cpu", path, true));
+      }
+    }
+
+    return cpus > 0.0 ? (unsigned int)std::max(1.0, std::ceil(cpus)) : 0;
+#else
+    return 0;
+#endif
+  }
+
+private:
+  void track(int u) {
+    int p = peak.load(std::memory_order_relaxed);
+
+    while (u > p &&
+           !peak.compare_exchange_weak(p, u, std::memory_order_relaxed))
+      ;
+  }
+
+  /* CPUs in the affinity mask within the quota, PARALLEL_F_QUOTA=0 ignores the quota */
+  static unsigned int default_capacity() {
+    unsigned int n = std::thread::hardware_concurrency();
+
+#ifdef __linux__
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+      n = (unsigned int)CPU_COUNT(&set);
+#endif
+
+    const char *quota = std::getenv("PARALLEL_F_QUOTA");
+    unsigned int q = quota && std::string(quota) == "0" ? 0 : cpu_quota();
+
+    return q ? std::min(n, q) : n;
+  }
+
+  static double lowest(double a, double b) {
+    if (a <= 0.0)
+      return b;
+
+    return b > 0.0 ? std::min(a, b) : a;
+  }
+
+  static bool read(const std::string &path, std::string &value) {
+    std::ifstream f(path);
+
+    if (!f)
+      return false;
+
+    std::getline(f, value);
+
+    return true;
+  }
+
+  /* lowest quota in CPUs from 'root' + 'path' up to 'root', zero for none */
+  static double quota_of(const std::string &root, std::string path, bool v1) {
+    double cpus = 0.0;
+
+    for (;;) {
+      std::string dir = root + (path == "/" ? "" : path);
+      std::string value;
+      double quota = -1.0;
+      double period = 0.0;
+
+      if (v1) {
+        std::string p;
+
+        if (read(dir + "/cpu.cfs_quota_us", value) &&
+            read(dir + "/cpu.cfs_period_us", p)) {
+          try {
+            quota = std::stod(value);
+            period = std::stod(p);
+          } catch (const std::exception &) {
+          }
+        }
+      } else if (read(dir + "/cpu.max", value)) {
+        /* "max 100000" or "<quota> <period>" */
+        std::stringstream ss(value);
+        std::string q;
+
+        ss >> q >> period;
+
+        if (q != "max") {
+          try {
+            quota = std::stod(q);
+          } catch (const std::exception &) {
+          }
+        }
+      }
+
+      if (quota > 0.0 && period > 0.0)
+        cpus = lowest(cpus, quota / period);
+
+      size_t slash = path.rfind('/');
+
+      if (path.empty() || path == "/" || slash == std::string::npos)
+        break;
+
+      path = slash ? path.substr(0, slash) : "/";
+    }
+
+    return cpus;
+  }
+};
+
+} // namespace parallel_f
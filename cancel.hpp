@@ -0,0 +1,243 @@
+// === (C) 2020-2024 === parallel_f / cancel (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace parallel_f {
+
+namespace details {
+
+/* something to skip when a cancel_token gets cancelled, see task_node */
+class cancel_target {
+public:
+  virtual ~cancel_target() {}
+
+  /* first pass, prevents starting */
+  virtual void mark_cancelled() = 0;
+
+  /* second pass, releases resources and completes */
+  virtual void cancel_now() = 0;
+};
+
+class cancel_state {
+public:
+  std::atomic<bool> cancelled;
+  int64_t deadline; // steady clock in ns, zero for none
+  std::shared_ptr<cancel_state> parent;
+  std::mutex lock;
+  std::vector<std::weak_ptr<cancel_target>> targets;
+  std::vector<std::weak_ptr<cancel_state>> children;
+  std::vector<std::function<void(void)>> callbacks;
+  size_t prune_targets;  // size at which 'targets' is pruned next
+  size_t prune_children; // same for 'children'
+
+  cancel_state()
+      : cancelled(false), deadline(0), prune_targets(64), prune_children(64) {}
+
+  static int64_t clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  bool is_cancelled() const {
+    for (const cancel_state *s = this; s; s = s->parent.get()) {
+      if (s->cancelled.load(std::memory_order_relaxed))
+        return true;
+
+      if (s->deadline && clock_ns() > s->deadline)
+        return true;
+    }
+
+    return false;
+  }
+
+  void cancel() {
+    if (cancelled.exchange(true))
+      return;
+
+    std::unique_lock<std::mutex> l(lock);
+
+    auto t = std::move(targets);
+    auto c = std::move(children);
+    auto f = std::move(callbacks);
+
+    l.unlock();
+
+    std::vector<std::shared_ptr<cancel_target>> alive;
+
+    /* mark all first, so no target gets started by another one completing */
+    for (auto &w : t) {
+      auto p = w.lock();
+
+      if (p) {
+        p->mark_cancelled();
+
+        alive.push_back(std::move(p));
+      }
+    }
+
+    for (auto &w : c) {
+      auto p = w.lock();
+
+      if (p)
+        p->cancel();
+    }
+
+    for (auto &p : alive)
+      p->cancel_now();
+
+    for (auto &func : f)
+      func();
+  }
+
+  void attach(std::weak_ptr<cancel_target> target) {
+    std::unique_lock<std::mutex> l(lock);
+
+    if (cancelled) {
+      l.unlock();
+
+      auto p = target.lock();
+
+      if (p) {
+        p->mark_cancelled();
+        p->cancel_now();
+      }
+
+      return;
+    }
+
+    prune(targets, prune_targets);
+
+    targets.push_back(std::move(target));
+  }
+
+  /* links a token made by with_timeout(), cancelled already if we are */
+  void adopt(const std::shared_ptr<cancel_state> &child) {
+    std::unique_lock<std::mutex> l(lock);
+
+    if (cancelled) {
+      child->cancelled = true;
+      return;
+    }
+
+    prune(children, prune_children);
+
+    children.push_back(child);
+  }
+
+private:
+  /* lock held, drops entries that are gone, amortized */
+  template <typename T>
+  static void prune(std::vector<std::weak_ptr<T>> &list, size_t &at) {
+    if (list.size() < at)
+      return;
+
+    std::vector<std::weak_ptr<T>> live;
+
+    for (auto &w : list) {
+      if (!w.expired())
+        live.push_back(std::move(w));
+    }
+
+    list = std::move(live);
+
+    at = list.size() * 2 + 64;
+  }
+};
+
+} // namespace details
+
+// parallel_f :: cancel_token == implementation
+
+/*
+ * Cooperative cancellation shared by tasks, task_lists and task_queues.
+ *
+ * A default constructed token is empty and never cancelled, use make() to get
+ * a live one. Cancelling skips every task attached to the token which has not
+ * been started yet, dropping its arguments and result right away and
+ * completing it, so joins and successors proceed. Running tasks may poll
+ * parallel_f::cancelled().
+ *
+ * Tokens with a timeout count as cancelled once it has passed. This is checked
+ * when tasks are about to start and when polled, there is no timer thread.
+ * Tasks already queued to run are skipped as well when they get their turn.
+ */
+class cancel_token {
+private:
+  std::shared_ptr<details::cancel_state> state;
+
+  cancel_token(std::shared_ptr<details::cancel_state> state) : state(state) {}
+
+public:
+  cancel_token() {}
+
+  static cancel_token make() {
+    return cancel_token(std::make_shared<details::cancel_state>());
+  }
+
+  static cancel_token make(std::chrono::steady_clock::duration timeout) {
+    return make().with_timeout(timeout);
+  }
+
+  /* a token cancelled along with this one, or after 'timeout' from now */
+  cancel_token with_timeout(std::chrono::steady_clock::duration timeout) const {
+    auto s = std::make_shared<details::cancel_state>();
+
+    s->deadline =
+        details::cancel_state::clock_ns() +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+
+    if (state) {
+      s->parent = state;
+
+      state->adopt(s);
+    }
+
+    return cancel_token(s);
+  }
+
+  explicit operator bool() const { return state != nullptr; }
+
+  bool operator==(const cancel_token &other) const {
+    return state == other.state;
+  }
+
+  bool is_cancelled() const { return state && state->is_cancelled(); }
+
+  void cancel() {
+    if (state)
+      state->cancel();
+  }
+
+  /* called once on cancel(), right away if cancelled already */
+  void on_cancel(std::function<void(void)> func) {
+    if (!state)
+      return;
+
+    std::unique_lock<std::mutex> l(state->lock);
+
+    if (!state->cancelled) {
+      state->callbacks.push_back(std::move(func));
+      return;
+    }
+
+    l.unlock();
+
+    func();
+  }
+
+  void attach(std::weak_ptr<details::cancel_target> target) {
+    if (state)
+      state->attach(std::move(target));
+  }
+};
+
+} // namespace parallel_f
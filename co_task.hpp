@@ -0,0 +1,344 @@
+// === (C) 2020-2024 === parallel_f / co_task (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+#include "log.hpp"
+
+#include "future_value.hpp"
+#include "joinable.hpp"
+#include "vthread.hpp"
+
+namespace parallel_f {
+
+namespace core {
+
+template <typename T = void> class co_task;
+
+namespace co_details {
+
+/* continues a suspended coroutine on the vthread manager */
+static inline void resume(std::coroutine_handle<> handle) {
+  LOG_DEBUG("co_details::resume(%p)\n", handle.address());
+
+  auto thread = std::make_shared<vthread>("co");
+
+  thread->start([handle]() { handle.resume(); });
+}
+
+/* blocks the caller (or suspends the calling vthread) until 'task' is done */
+static inline void wait_finished(std::shared_ptr<task_base> task) {
+  if (task->get_state() == task_base::task_state::FINISHED)
+    return;
+
+  if (vthread::is_managed_thread()) {
+    vthread::suspend([task](std::shared_ptr<vthread> self) {
+      task->on_finished([self]() { vthread::resume(self); });
+
+      return true;
+    });
+  } else {
+    std::mutex lock;
+    std::condition_variable cond;
+    bool finished = false;
+
+    task->on_finished([&lock, &cond, &finished]() {
+      std::unique_lock<std::mutex> l(lock);
+
+      finished = true;
+
+      cond.notify_one();
+    });
+
+    std::unique_lock<std::mutex> l(lock);
+
+    while (!finished)
+      cond.wait(l);
+  }
+}
+
+/*
+ * Shared state of a co_task, also being the task_base to be pushed to a
+ * task_queue or appended to a task_list.
+ *
+ * The state owns the coroutine frame until it gets started, from then on the
+ * frame keeps the state alive until it reaches its final suspend point.
+ */
+template <typename T> class co_state : public task_result<T> {
+public:
+  std::coroutine_handle<> handle;
+  std::shared_ptr<co_state> self;
+  std::exception_ptr error;
+  bool started;
+
+  co_state() : started(false) {}
+
+  virtual ~co_state() {
+    if (!started && handle)
+      handle.destroy();
+  }
+
+  template <typename V> void set_value(V &&v) {
+    this->value = std::forward<V>(v);
+  }
+
+  T get_value() {
+    if (error)
+      std::rethrow_exception(error);
+
+    if constexpr (!std::is_void_v<T>)
+      return this->value.value();
+  }
+
+  void complete() { this->enter_state(task_base::task_state::FINISHED); }
+
+protected:
+  virtual bool run() {
+    LOG_DEBUG("co_state::run()\n");
+
+    started = true;
+
+    self = std::static_pointer_cast<co_state>(this->shared_from_this());
+
+    resume(handle);
+
+    return false;
+  }
+};
+
+template <typename T> class promise_base {
+public:
+  co_state<T> *state;
+
+  class final_awaiter {
+  public:
+    bool await_ready() noexcept { return false; }
+
+    template <typename P>
+    void await_suspend(std::coroutine_handle<P> handle) noexcept {
+      std::shared_ptr<co_state<T>> s = std::move(handle.promise().state->self);
+
+      s->handle = nullptr;
+
+      handle.destroy();
+
+      s->complete();
+    }
+
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+
+  final_awaiter final_suspend() noexcept { return {}; }
+
+  void unhandled_exception() { state->error = std::current_exception(); }
+
+protected:
+  template <typename P> co_task<T> make_return_object(P &promise) {
+    auto s = std::make_shared<co_state<T>>();
+
+    s->handle = std::coroutine_handle<P>::from_promise(promise);
+
+    state = s.get();
+
+    return co_task<T>(s);
+  }
+};
+
+template <typename T> class promise : public promise_base<T> {
+public:
+  co_task<T> get_return_object() { return this->make_return_object(*this); }
+
+  template <typename V> void return_value(V &&v) {
+    this->state->set_value(T(std::forward<V>(v)));
+  }
+};
+
+template <> class promise<void> : public promise_base<void> {
+public:
+  co_task<void> get_return_object();
+
+  void return_void() {}
+};
+
+/* waits for a task to finish, yielding its result if it has one */
+template <typename T> class task_awaiter {
+private:
+  std::shared_ptr<T> task;
+  bool start;
+
+public:
+  task_awaiter(std::shared_ptr<T> task, bool start)
+      : task(task), start(start) {}
+
+  bool await_ready() const {
+    return task->get_state() == task_base::task_state::FINISHED;
+  }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    /* the awaiter lives in the frame, which may be resumed (and destroyed)
+     * once on_finished() is called, so nothing of it is used afterwards */
+    std::shared_ptr<T> t = task;
+    bool s = start;
+
+    t->on_finished([handle]() { resume(handle); });
+
+    if (s) {
+      auto thread = std::make_shared<vthread>("co_exec");
+
+      thread->start([t]() { t->finish(); });
+    }
+  }
+
+  auto await_resume() const {
+    if constexpr (std::is_base_of_v<task_info, T>)
+      return task->result();
+  }
+};
+
+} // namespace co_details
+
+// parallel_f :: co_task == implementation
+
+/*
+ * A coroutine running on the vthread manager, e.g.
+ *
+ *   parallel_f::co_task<int> compute(std::shared_ptr<...> input) {
+ *     auto value = co_await input;           // wait for another task
+ *     co_await some_queue.exec(true);        // wait for a joinable
+ *     co_return value.get<int>() + 1;
+ *   }
+ *
+ * A suspended co_task occupies no vthread or worker, just its frame. The
+ * coroutine starts lazily when start() or get() is called, when it is
+ * awaited, or when task() has been pushed/appended and gets executed.
+ */
+template <typename T> class co_task {
+  friend class co_details::promise_base<T>;
+
+public:
+  typedef co_details::promise<T> promise_type;
+
+private:
+  std::shared_ptr<co_details::co_state<T>> state;
+
+  co_task(std::shared_ptr<co_details::co_state<T>> state) : state(state) {}
+
+public:
+  /* the task_base to push to a task_queue or append to a task_list */
+  std::shared_ptr<task_base> task() const { return state; }
+
+  /* a future_value<T>, for co_task<void> a task_info::Value */
+  auto result() const { return state->result(); }
+
+  co_task &start() {
+    state->finish();
+
+    return *this;
+  }
+
+  T get() {
+    start();
+
+    co_details::wait_finished(state);
+
+    return state->get_value();
+  }
+
+  auto operator co_await() const {
+    class awaiter {
+    private:
+      std::shared_ptr<co_details::co_state<T>> state;
+
+    public:
+      awaiter(std::shared_ptr<co_details::co_state<T>> state) : state(state) {}
+
+      bool await_ready() const {
+        return state->get_state() == task_base::task_state::FINISHED;
+      }
+
+      void await_suspend(std::coroutine_handle<> handle) {
+        std::shared_ptr<co_details::co_state<T>> s = state;
+
+        s->on_finished([handle]() { co_details::resume(handle); });
+
+        s->finish();
+      }
+
+      T await_resume() { return state->get_value(); }
+    };
+
+    return awaiter(state);
+  }
+};
+
+inline co_task<void> co_details::promise<void>::get_return_object() {
+  return make_return_object(*this);
+}
+
+/* co_await a task started elsewhere (task_queue, task_list, task_cl...) */
+template <typename T,
+          typename = std::enable_if_t<std::is_base_of_v<task_base, T>>>
+auto operator co_await(std::shared_ptr<T> task) {
+  return co_details::task_awaiter<T>(task, false);
+}
+
+/* co_await the task producing a value */
+static inline auto operator co_await(task_info::Value value) {
+  return co_details::task_awaiter<task_info>(value.get_task(), false);
+}
+
+/* co_await the task producing a typed value, resumes with the future_value */
+template <typename R> auto operator co_await(future_value<R> value) {
+  return co_details::task_awaiter<task_result<R>>(
+      std::static_pointer_cast<task_result<R>>(value.get_task()), false);
+}
+
+/* runs a single task on the vthread manager and awaits it */
+template <typename T,
+          typename = std::enable_if_t<std::is_base_of_v<task_base, T>>>
+auto co_exec(std::shared_ptr<T> task) {
+  return co_details::task_awaiter<T>(task, true);
+}
+
+} // namespace core
+
+/* co_await the tasks of task_queue::exec(true) or task_list::finish(true) */
+static inline auto operator co_await(joinable j) {
+  class awaiter {
+  private:
+    joinable j;
+
+  public:
+    awaiter(joinable j) : j(j) {}
+
+    bool await_ready() const { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      joinable copy = j;
+
+      copy.then([handle]() { core::co_details::resume(handle); });
+    }
+
+    void await_resume() const {}
+  };
+
+  return awaiter(j);
+}
+
+using core::co_exec;
+using core::co_task;
+
+} // namespace parallel_f
+
+#endif
@@ -0,0 +1,261 @@
+// === (C) 2020-2024 === parallel_f / completion (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace parallel_f {
+
+// parallel_f :: completion == implementation
+
+/*
+ * Single-shot event without locks, e.g. a task entering the FINISHED state.
+ *
+ * Waiters are linked into an atomic intrusive list, complete() closes it with
+ * one exchange and calls them in the order they were added, on its thread.
+ * Waiters added afterwards are called right away by attach(), or refused by
+ * add(). Neither side takes a lock or allocates, so nothing is held while the
+ * waiters run, which may attach to other completions or finish other tasks.
+ */
+class completion {
+public:
+  class waiter {
+  private:
+    friend class completion;
+
+    waiter *next_waiter = nullptr;
+
+  public:
+    virtual void completed() = 0;
+
+    /* still linked when the completion is destroyed, never completed */
+    virtual void discarded() {}
+  };
+
+private:
+  std::atomic<waiter *> head;
+  std::atomic<unsigned int> detaching;
+
+  /* 'head' while complete() calls the waiters, and after */
+  static waiter *firing() { return reinterpret_cast<waiter *>(uintptr_t(1)); }
+  static waiter *done() { return reinterpret_cast<waiter *>(uintptr_t(2)); }
+
+public:
+  completion() : head(nullptr), detaching(0) {}
+
+  ~completion() {
+    waiter *w = head.load(std::memory_order_acquire);
+
+    if (w == firing() || w == done())
+      return;
+
+    while (w) {
+      waiter *next = w->next_waiter;
+
+      w->discarded();
+
+      w = next;
+    }
+  }
+
+  completion(const completion &) = delete;
+  completion &operator=(const completion &) = delete;
+
+  bool is_complete() const {
+    waiter *w = head.load(std::memory_order_acquire);
+
+    return w == firing() || w == done();
+  }
+
+  /* links 'w', false if completed already (w is not called then) */
+  bool add(waiter *w) {
+    waiter *h = head.load(std::memory_order_acquire);
+
+    do {
+      if (h == firing() || h == done())
+        return false;
+
+      w->next_waiter = h;
+    } while (!head.compare_exchange_weak(h, w, std::memory_order_release,
+                                         std::memory_order_acquire));
+
+    return true;
+  }
+
+  /* links 'w', calls it right away if completed already */
+  void attach(waiter *w) {
+    if (!add(w))
+      w->completed();
+  }
+
+  /*
+   * Unlinks 'w' if it has not been called yet, otherwise waits for a running
+   * complete() to return. Rare, so it briefly takes the list out of 'head'
+   * instead of marking waiters, whoever adds meanwhile starts a new one.
+   * Detachers take turns, a second one would find the list taken.
+   *
+   * Called from a waiter's completed() (possibly further down the stack) of
+   * this completion, 'w' is taken out of the waiters still to be called on
+   * this thread, if it is one of them, without waiting for ourself.
+   */
+  void detach(waiter *w) {
+    waiter *list;
+
+    while (true) {
+      list = head.load(std::memory_order_acquire);
+
+      if (list == done())
+        return;
+
+      if (list == firing()) {
+        if (detach_calling(w))
+          return;
+
+        std::this_thread::yield();
+        continue;
+      }
+
+      /* before taking it, so complete() waits for the rest to be handed on */
+      unsigned int idle = 0;
+
+      if (!detaching.compare_exchange_strong(idle, 1,
+                                             std::memory_order_acq_rel)) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      if (head.compare_exchange_strong(list, nullptr,
+                                       std::memory_order_acq_rel))
+        break;
+
+      detaching.store(0, std::memory_order_release);
+    }
+
+    waiter *tail = nullptr;
+
+    for (waiter **p = &list; *p; p = &(*p)->next_waiter) {
+      if (*p == w)
+        *p = w->next_waiter;
+
+      if (!*p)
+        break;
+
+      tail = *p;
+    }
+
+    if (list) {
+      waiter *h = head.load(std::memory_order_acquire);
+
+      do {
+        /* completed meanwhile, the rest are late waiters now */
+        if (h == firing() || h == done()) {
+          call(list, true);
+          break;
+        }
+
+        tail->next_waiter = h;
+      } while (!head.compare_exchange_weak(h, list, std::memory_order_release,
+                                           std::memory_order_acquire));
+    }
+
+    detaching.store(0, std::memory_order_release);
+  }
+
+  /* calls all waiters, has no effect after the first call */
+  void complete() {
+    waiter *list = head.exchange(firing(), std::memory_order_acq_rel);
+
+    if (list == firing() || list == done())
+      return;
+
+    call(list);
+
+    /* waiters taken by a detach() are not done before it hands them on */
+    while (detaching.load(std::memory_order_acquire))
+      std::this_thread::yield();
+
+    head.store(done(), std::memory_order_release);
+  }
+
+private:
+  /* a call() running on this thread, linked to those further up the stack */
+  class call_frame {
+  public:
+    const completion *owner;
+    waiter *next;    // still to be called
+    bool late;       // by a detach() holding 'detaching'
+    call_frame *outer;
+
+    call_frame(const completion *owner, waiter *next, bool late)
+        : owner(owner), next(next), late(late), outer(calling) {
+      calling = this;
+    }
+
+    ~call_frame() { calling = outer; }
+  };
+
+  static inline thread_local call_frame *calling = nullptr;
+
+  /* reverses the list for calling in the order of adding */
+  void call(waiter *list, bool late = false) {
+    waiter *ordered = nullptr;
+
+    while (list) {
+      waiter *next = list->next_waiter;
+
+      list->next_waiter = ordered;
+      ordered = list;
+
+      list = next;
+    }
+
+    call_frame frame(this, ordered, late);
+
+    /* 'next' first, 'w' may be gone once called */
+    while (waiter *w = frame.next) {
+      frame.next = w->next_waiter;
+
+      w->completed();
+    }
+  }
+
+  /*
+   * detach() while firing, false if we are not calling waiters on this thread.
+   * Otherwise 'w' is unlinked if still to be called here. If it is not, it is
+   * done or being called by us, or in the list of a racing detach() calling it
+   * on another thread, whose 'detaching' we wait for unless we hold it.
+   */
+  bool detach_calling(waiter *w) {
+    bool found = false, holding = false;
+
+    for (call_frame *f = calling; f; f = f->outer) {
+      if (f->owner != this)
+        continue;
+
+      found = true;
+
+      if (f->late)
+        holding = true;
+
+      for (waiter **p = &f->next; *p; p = &(*p)->next_waiter) {
+        if (*p == w) {
+          *p = w->next_waiter;
+          return true;
+        }
+      }
+    }
+
+    if (!found)
+      return false;
+
+    while (!holding && detaching.load(std::memory_order_acquire))
+      std::this_thread::yield();
+
+    return true;
+  }
+};
+
+} // namespace parallel_f
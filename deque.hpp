@@ -0,0 +1,198 @@
+// === (C) 2020-2024 === parallel_f / deque (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace parallel_f {
+
+namespace details {
+
+// parallel_f :: ws_deque == implementation
+
+/*
+ * Chase-Lev work-stealing deque of pointers (Le et al., "Correct and
+ * Efficient Work-Stealing for Weak Memory Models", PPoPP 2013).
+ *
+ * The owning worker pushes and takes at the bottom (LIFO), any other thread
+ * may steal from the top (FIFO). Buffers only grow, retired ones are kept
+ * until destruction as thieves may still read from them.
+ */
+template <typename T> class ws_deque {
+private:
+  class buffer {
+  public:
+    int64_t capacity;
+    std::unique_ptr<std::atomic<T *>[]> slots;
+
+    buffer(int64_t capacity)
+        : capacity(capacity), slots(new std::atomic<T *>[capacity]) {}
+
+    T *get(int64_t i) const {
+      return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, T *t) {
+      slots[i & (capacity - 1)].store(t, std::memory_order_relaxed);
+    }
+  };
+
+  alignas(64) std::atomic<int64_t> top;
+  alignas(64) std::atomic<int64_t> bottom;
+  std::atomic<buffer *> array;
+  std::vector<std::unique_ptr<buffer>> buffers;
+
+public:
+  ws_deque(int64_t capacity = 256) : top(0), bottom(0) {
+    buffers.emplace_back(new buffer(capacity));
+
+    array.store(buffers.back().get(), std::memory_order_relaxed);
+  }
+
+  ws_deque(const ws_deque &) = delete;
+  ws_deque &operator=(const ws_deque &) = delete;
+
+  /* owner only */
+  void push(T *t) {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t s = top.load(std::memory_order_acquire);
+    buffer *a = array.load(std::memory_order_relaxed);
+
+    if (b - s > a->capacity - 1) {
+      buffers.emplace_back(new buffer(a->capacity * 2));
+
+      for (int64_t i = s; i < b; i++)
+        buffers.back()->put(i, a->get(i));
+
+      a = buffers.back().get();
+
+      array.store(a, std::memory_order_release);
+    }
+
+    a->put(b, t);
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /* owner only */
+  T *take() {
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    buffer *a = array.load(std::memory_order_relaxed);
+
+    bottom.store(b, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+
+      return nullptr;
+    }
+
+    T *x = a->get(b);
+
+    if (t == b) {
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed))
+        x = nullptr;
+
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    return x;
+  }
+
+  /* any thread, returns nullptr if empty or lost a race */
+  T *steal() {
+    int64_t t = top.load(std::memory_order_acquire);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    int64_t b = bottom.load(std::memory_order_acquire);
+
+    if (t >= b)
+      return nullptr;
+
+    buffer *a = array.load(std::memory_order_acquire);
+
+    T *x = a->get(t);
+
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed))
+      return nullptr;
+
+    return x;
+  }
+
+  /* approximation when called concurrently */
+  size_t size() const {
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    return b > t ? (size_t)(b - t) : 0;
+  }
+
+  bool empty() const { return size() == 0; }
+};
+
+// parallel_f :: inject_queue == implementation
+
+/*
+ * Lock-free multi-producer queue for pushes from threads not owning a deque.
+ *
+ * Producers link elements via their intrusive 'inject_next' pointer using a
+ * CAS loop, consumers always detach the whole chain with a single exchange,
+ * so there is no ABA problem. Chains are returned oldest element first.
+ */
+template <typename T> class inject_queue {
+private:
+  std::atomic<T *> head;
+
+public:
+  inject_queue() : head(nullptr) {}
+
+  inject_queue(const inject_queue &) = delete;
+  inject_queue &operator=(const inject_queue &) = delete;
+
+  void push(T *t) {
+    T *h = head.load(std::memory_order_relaxed);
+
+    do {
+      t->inject_next = h;
+    } while (!head.compare_exchange_weak(h, t, std::memory_order_release,
+                                         std::memory_order_relaxed));
+  }
+
+  T *take_all() {
+    if (!head.load(std::memory_order_relaxed))
+      return nullptr;
+
+    T *h = head.exchange(nullptr, std::memory_order_acquire);
+    T *r = nullptr;
+
+    while (h) {
+      T *n = h->inject_next;
+
+      h->inject_next = r;
+
+      r = h;
+      h = n;
+    }
+
+    return r;
+  }
+
+  bool empty() const { return !head.load(std::memory_order_relaxed); }
+};
+
+} // namespace details
+
+} // namespace parallel_f
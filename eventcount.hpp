@@ -0,0 +1,192 @@
+// === (C) 2020-2024 === parallel_f / eventcount (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <climits>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#else
+#include <condition_variable>
+#include <mutex>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PARALLEL_F__CPU_RELAX() _mm_pause()
+#elif defined(__x86_64__) || defined(__i386__)
+#define PARALLEL_F__CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define PARALLEL_F__CPU_RELAX() asm volatile("yield")
+#else
+#define PARALLEL_F__CPU_RELAX() ((void)0)
+#endif
+
+namespace parallel_f {
+
+namespace details {
+
+// parallel_f :: eventcount == implementation
+
+/*
+ * Eventcount for parking idle threads without a lock on the notify path.
+ *
+ * A waiter announces itself with prepare_wait(), re-checks its condition and
+ * then either calls cancel_wait() or wait() with the returned key. Notifiers
+ * publish their change first, then call notify_one() or notify_all(), which
+ * only touch the futex (WaitOnAddress on Windows) if somebody is waiting.
+ * A notify between prepare_wait() and wait() advances the epoch, so wait()
+ * returns right away and no wakeup is lost.
+ */
+class eventcount {
+private:
+  std::atomic<uint32_t> epoch;
+  std::atomic<int> waiters;
+
+#if !defined(__linux__) && !defined(_WIN32)
+  std::mutex mutex;
+  std::condition_variable cond;
+#endif
+
+public:
+  eventcount() : epoch(0), waiters(0) {}
+
+  eventcount(const eventcount &) = delete;
+  eventcount &operator=(const eventcount &) = delete;
+
+  uint32_t prepare_wait() {
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+
+    return epoch.load(std::memory_order_seq_cst);
+  }
+
+  void cancel_wait() { waiters.fetch_sub(1, std::memory_order_relaxed); }
+
+  void wait(uint32_t key) {
+    while (epoch.load(std::memory_order_acquire) == key)
+      block(key);
+
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  /* like wait(), but gives up after 'ns', returns false if it did */
+  bool wait_for(uint32_t key, int64_t ns) {
+    int64_t deadline = clock_ns() + ns;
+    bool notified = true;
+
+    while (epoch.load(std::memory_order_acquire) == key) {
+      int64_t left = deadline - clock_ns();
+
+      if (left <= 0) {
+        notified = false;
+        break;
+      }
+
+      block_for(key, left);
+    }
+
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+
+    return notified;
+  }
+
+  void notify_one() { notify(false); }
+
+  void notify_all() { notify(true); }
+
+  int num_waiters() const { return waiters.load(std::memory_order_relaxed); }
+
+private:
+  static int64_t clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  void notify(bool all) {
+    /* pairs with prepare_wait(), either we see the waiter or it sees our change */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    if (!waiters.load(std::memory_order_relaxed))
+      return;
+
+    epoch.fetch_add(1, std::memory_order_release);
+
+    wake(all);
+  }
+
+#if defined(__linux__)
+  void block(uint32_t key) {
+    syscall(SYS_futex, (uint32_t *)&epoch, FUTEX_WAIT_PRIVATE, key, nullptr,
+            nullptr, 0);
+  }
+
+  void block_for(uint32_t key, int64_t ns) {
+    struct timespec ts;
+
+    ts.tv_sec = (time_t)(ns / 1000000000);
+    ts.tv_nsec = (long)(ns % 1000000000);
+
+    syscall(SYS_futex, (uint32_t *)&epoch, FUTEX_WAIT_PRIVATE, key, &ts,
+            nullptr, 0);
+  }
+
+  void wake(bool all) {
+    syscall(SYS_futex, (uint32_t *)&epoch, FUTEX_WAKE_PRIVATE,
+            all ? INT_MAX : 1, nullptr, nullptr, 0);
+  }
+#elif defined(_WIN32)
+  void block(uint32_t key) {
+    WaitOnAddress((volatile VOID *)&epoch, &key, sizeof(key), INFINITE);
+  }
+
+  void block_for(uint32_t key, int64_t ns) {
+    WaitOnAddress((volatile VOID *)&epoch, &key, sizeof(key),
+                  (DWORD)(ns / 1000000 + 1));
+  }
+
+  void wake(bool all) {
+    if (all)
+      WakeByAddressAll((PVOID)&epoch);
+    else
+      WakeByAddressSingle((PVOID)&epoch);
+  }
+#else
+  void block(uint32_t key) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (epoch.load(std::memory_order_acquire) == key)
+      cond.wait(lock);
+  }
+
+  void block_for(uint32_t key, int64_t ns) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (epoch.load(std::memory_order_acquire) == key)
+      cond.wait_for(lock, std::chrono::nanoseconds(ns));
+  }
+
+  void wake(bool all) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (all)
+      cond.notify_all();
+    else
+      cond.notify_one();
+  }
+#endif
+};
+
+} // namespace details
+
+} // namespace parallel_f
@@ -0,0 +1,170 @@
+// === (C) 2020-2024 === parallel_f / fiber (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#define PARALLEL_F__NOINLINE __declspec(noinline)
+#else
+#define PARALLEL_F__NOINLINE __attribute__((noinline))
+#endif
+
+namespace parallel_f {
+
+namespace details {
+
+// parallel_f :: fiber == implementation
+
+/*
+ * A fiber is a user-mode execution context with its own stack.
+ *
+ * A default constructed fiber represents the calling thread's own context
+ * and has to be set up via convert_thread() before switching away from it.
+ * The entry function of a fiber created with a stack must never return,
+ * fibers are meant to loop and be reused (see vthread::manager).
+ *
+ * Fibers may be resumed on a different thread than the one they were
+ * suspended on, so code running on them must not cache thread-local
+ * addresses across a switch (see PARALLEL_F__NOINLINE accessors).
+ */
+class fiber {
+public:
+  typedef void (*entry_f)(void *);
+
+private:
+  entry_f entry;
+  void *arg;
+
+#ifdef _WIN32
+  LPVOID handle;
+  bool converted;
+
+  static VOID CALLBACK trampoline(LPVOID param) {
+    fiber *f = (fiber *)param;
+
+    f->entry(f->arg);
+
+    std::abort();
+  }
+#else
+  ucontext_t context;
+  void *stack;
+  size_t stack_size;
+
+  static void trampoline(unsigned int hi, unsigned int lo) {
+    fiber *f = (fiber *)(((uintptr_t)hi << 32) | (uintptr_t)lo);
+
+    f->entry(f->arg);
+
+    std::abort();
+  }
+#endif
+
+public:
+  fiber() : entry(nullptr), arg(nullptr) {
+#ifdef _WIN32
+    handle = nullptr;
+    converted = false;
+#else
+    stack = nullptr;
+    stack_size = 0;
+#endif
+  }
+
+  fiber(size_t size, entry_f entry, void *arg) : entry(entry), arg(arg) {
+#ifdef _WIN32
+    converted = false;
+
+    handle = CreateFiber(size, trampoline, this);
+
+    if (!handle)
+      throw std::runtime_error("CreateFiber failed");
+#else
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    stack_size = (size + page - 1) / page * page + page;
+
+    stack = mmap(nullptr, stack_size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+
+    if (stack == MAP_FAILED)
+      throw std::runtime_error("fiber stack allocation failed");
+
+    /* guard page at the low end, stacks grow downwards */
+    mprotect(stack, page, PROT_NONE);
+
+    getcontext(&context);
+
+    context.uc_stack.ss_sp = stack;
+    context.uc_stack.ss_size = stack_size;
+    context.uc_link = nullptr;
+
+    uintptr_t p = (uintptr_t)this;
+
+    makecontext(&context, (void (*)())trampoline, 2,
+                (unsigned int)(p >> 32), (unsigned int)(p & 0xffffffff));
+#endif
+  }
+
+  ~fiber() {
+#ifdef _WIN32
+    if (handle && !converted)
+      DeleteFiber(handle);
+#else
+    if (stack)
+      munmap(stack, stack_size);
+#endif
+  }
+
+  fiber(const fiber &) = delete;
+  fiber &operator=(const fiber &) = delete;
+
+  /* make the calling thread's context switchable */
+  void convert_thread() {
+#ifdef _WIN32
+    handle = ConvertThreadToFiber(nullptr);
+
+    if (!handle)
+      throw std::runtime_error("ConvertThreadToFiber failed");
+
+    converted = true;
+#endif
+  }
+
+  void revert_thread() {
+#ifdef _WIN32
+    if (converted)
+      ConvertFiberToThread();
+
+    handle = nullptr;
+    converted = false;
+#endif
+  }
+
+  /* save the current context into this and continue on 'to' */
+  void switch_to(fiber &to) {
+#ifdef _WIN32
+    (void)this;
+
+    SwitchToFiber(to.handle);
+#else
+    swapcontext(&context, &to.context);
+#endif
+  }
+};
+
+} // namespace details
+
+} // namespace parallel_f
@@ -0,0 +1,147 @@
+// === (C) 2020-2024 === parallel_f / future_value (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <any>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "task_info.hpp"
+
+namespace parallel_f {
+
+namespace core {
+
+template <typename R> class future_value;
+
+/* what a task keeps of a callable's result, references and const ones are
+ * stored as a copy of the value, like in a std::any before */
+template <typename R>
+using stored_result_t = std::remove_cv_t<std::remove_reference_t<R>>;
+
+// parallel_f :: task_result == implementation
+
+/*
+ * Base of tasks producing an 'R', storing it as is instead of in a std::any.
+ *
+ * result() returns a future_value<R>, which converts to task_info::Value for
+ * callables still taking that.
+ */
+template <typename R> class task_result : public task_info {
+  friend class future_value<R>;
+
+protected:
+  std::optional<R> value;
+
+protected:
+  task_result() {}
+
+  template <typename Callable, typename... Args>
+  task_result(const Callable &callable, const Args &...args)
+      : task_info(callable, args...) {}
+
+public:
+  future_value<R> result() {
+    return future_value<R>(
+        std::static_pointer_cast<task_result>(this->shared_from_this()));
+  }
+
+protected:
+  /* empty for move-only results, which only future_value hands out */
+  virtual std::any get_any() {
+    if constexpr (std::is_copy_constructible_v<R>) {
+      if (value)
+        return std::any(*value);
+    }
+
+    return std::any();
+  }
+
+  virtual void drop() { value.reset(); }
+};
+
+/* nothing to store, result() is task_info's */
+template <> class task_result<void> : public task_info {
+protected:
+  task_result() {}
+
+  template <typename Callable, typename... Args>
+  task_result(const Callable &callable, const Args &...args)
+      : task_info(callable, args...) {}
+};
+
+// parallel_f :: future_value == implementation
+
+/*
+ * Typed handle to the result of a task, e.g. passed to a dependent task
+ *
+ *     auto load = parallel_f::make_task(func_load, filename);
+ *     auto scale = parallel_f::make_task(
+ *         [](parallel_f::future_value<std::shared_ptr<sf::Image>> image) {
+ *           return scale(*image.get());
+ *         },
+ *         load->result());
+ *
+ * The result is available once the task is finished. get() returns a
+ * reference to it, so any number of consumers may read it without copying,
+ * while take() moves it out for a single consumer. Reading a result that has
+ * been taken, dropped by cancelling the task or not produced yet throws
+ * std::logic_error.
+ *
+ * Like task_info::Value it keeps the task alive and converts to one, its
+ * get<T>() works like Value's.
+ */
+template <typename R> class future_value {
+private:
+  std::shared_ptr<task_result<R>> task;
+
+public:
+  explicit future_value(std::shared_ptr<task_result<R>> task) : task(task) {}
+
+  bool ready() const {
+    return task->get_state() == task_base::task_state::FINISHED &&
+           task->value.has_value();
+  }
+
+  const R &get() const { return stored(); }
+
+  R take() {
+    R r = std::move(stored());
+
+    task->value.reset();
+
+    return r;
+  }
+
+  /* like task_info::Value::get<T>(), without a copy into a std::any for R */
+  template <typename T> T get() const {
+    if constexpr (std::is_same_v<T, R>)
+      return stored();
+    else if constexpr (std::is_same_v<T, std::any>)
+      return task->get_any();
+    else
+      return std::any_cast<T>(task->get_any());
+  }
+
+  std::shared_ptr<task_info> get_task() const { return task; }
+
+  operator task_info::Value() const { return task_info::Value(task); }
+
+private:
+  R &stored() const {
+    if (!task->value)
+      throw std::logic_error("future_value: no result");
+
+    return *task->value;
+  }
+};
+
+} // namespace core
+
+using core::future_value;
+
+} // namespace parallel_f
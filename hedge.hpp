@@ -0,0 +1,205 @@
+// === (C) 2020-2024 === parallel_f / hedge (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "budget.hpp"
+#include "log.hpp"
+#include "stats.hpp"
+
+namespace parallel_f {
+
+/* tag for make_task(parallel_f::hedge, ...), see task */
+struct hedge_t {
+  explicit hedge_t() = default;
+};
+
+inline constexpr hedge_t hedge{};
+
+// parallel_f :: hedging == implementation
+
+/*
+ * Settings for hedged tasks: a duplicate of a hedged task is started once it
+ * has been running for longer than the given percentile of the durations seen
+ * for the same callable type, after at least 'min_samples' of them.
+ */
+class hedging {
+private:
+  static inline std::atomic<double> percentile{0.95};
+  static inline std::atomic<unsigned int> min_samples{16};
+
+public:
+  static void set_percentile(double p) { percentile = p; }
+
+  static double get_percentile() { return percentile; }
+
+  static void set_min_samples(unsigned int n) { min_samples = n; }
+
+  static unsigned int get_min_samples() { return min_samples; }
+};
+
+namespace details {
+
+/* recent durations of one callable type */
+class hedge_history {
+private:
+  static const size_t capacity = 64;
+
+  std::mutex lock;
+  std::vector<int64_t> samples; // ring buffer
+  size_t pos;
+  size_t num;
+
+public:
+  hedge_history() : samples(capacity), pos(0), num(0) {}
+
+  void report(int64_t ns) {
+    std::unique_lock<std::mutex> l(lock);
+
+    samples[pos] = ns;
+
+    pos = (pos + 1) % capacity;
+
+    if (num < capacity)
+      num++;
+  }
+
+  /* zero while there are too few samples */
+  int64_t threshold() {
+    std::unique_lock<std::mutex> l(lock);
+
+    if (!num || num < hedging::get_min_samples())
+      return 0;
+
+    std::vector<int64_t> s(samples.begin(), samples.begin() + num);
+
+    l.unlock();
+
+    size_t n = std::min(s.size() - 1,
+                        (size_t)(hedging::get_percentile() * s.size()));
+
+    std::nth_element(s.begin(), s.begin() + n, s.end());
+
+    return s[n];
+  }
+};
+
+/*
+ * Single thread calling back at given points in time, used to check running
+ * hedged tasks. Callbacks return the time to be called again at, or zero.
+ */
+class hedge_timer {
+private:
+  class entry {
+  public:
+    int64_t due;
+    std::function<int64_t(int64_t)> func;
+
+    bool operator<(const entry &other) const { return due > other.due; }
+  };
+
+  std::mutex lock;
+  std::condition_variable cond;
+  std::priority_queue<entry> entries;
+  std::thread *thread;
+  bool stop;
+
+public:
+  /* initialized up front, so they outlive the executors */
+  static inline std::shared_ptr<stats::counter> started =
+      stats::instance::get().make_counter("hedge.started");
+  static inline std::shared_ptr<stats::counter> won =
+      stats::instance::get().make_counter("hedge.won");
+
+  static hedge_timer &instance() {
+    static hedge_timer timer_instance;
+
+    return timer_instance;
+  }
+
+  static int64_t clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  hedge_timer() : thread(0), stop(false) {}
+
+  ~hedge_timer() {
+    std::unique_lock<std::mutex> l(lock);
+
+    stop = true;
+
+    cond.notify_all();
+
+    l.unlock();
+
+    if (thread) {
+      thread->join();
+
+      delete thread;
+
+      budget::instance().release();
+    }
+  }
+
+  void add(int64_t due, std::function<int64_t(int64_t)> func) {
+    std::unique_lock<std::mutex> l(lock);
+
+    if (!thread) {
+      budget::instance().acquire();
+
+      thread = new std::thread([this]() { loop(); });
+    }
+
+    entries.push(entry{due, std::move(func)});
+
+    cond.notify_all();
+  }
+
+private:
+  void loop() {
+    std::unique_lock<std::mutex> l(lock);
+
+    while (!stop) {
+      if (entries.empty()) {
+        cond.wait(l);
+        continue;
+      }
+
+      int64_t now = clock_ns();
+
+      if (entries.top().due > now) {
+        cond.wait_for(l, std::chrono::nanoseconds(entries.top().due - now));
+        continue;
+      }
+
+      entry e = entries.top();
+
+      entries.pop();
+
+      l.unlock();
+
+      int64_t again = e.func(now);
+
+      l.lock();
+
+      if (again)
+        entries.push(entry{again, std::move(e.func)});
+    }
+  }
+};
+
+} // namespace details
+
+} // namespace parallel_f
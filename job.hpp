@@ -0,0 +1,29 @@
+// === (C) 2020-2024 === parallel_f / job (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include "priority.hpp"
+
+namespace parallel_f {
+
+namespace details {
+
+// parallel_f :: job == implementation
+
+/*
+ * Unit of work on the workers' job deques, much lighter than a vthread: no
+ * name, fiber or reference counting. Jobs run on whichever vthread takes them,
+ * e.g. one waiting for its task_group, or one started by an idle worker.
+ */
+class job {
+public:
+  void (*func)(job *);
+  priority prio;
+
+  void run() { func(this); }
+};
+
+} // namespace details
+
+} // namespace parallel_f
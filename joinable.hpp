@@ -15,16 +15,22 @@ class task_queue;
 class task_list;
 } // namespace core
 
+template <typename... Nodes> class static_graph;
+
 // parallel_f :: task_queue == implementation
 
 class joinable {
   friend class core::task_queue;
   friend class core::task_list;
+  template <typename... Nodes> friend class static_graph;
 
 private:
   std::function<void(void)> join_f;
+  std::function<void(std::function<void(void)>)> then_f;
 
-  joinable(std::function<void(void)> join_f) : join_f(join_f) {}
+  joinable(std::function<void(void)> join_f,
+           std::function<void(std::function<void(void)>)> then_f = nullptr)
+      : join_f(join_f), then_f(then_f) {}
 
 public:
   joinable() {}
@@ -36,6 +42,16 @@ public:
     if (join_f)
       join_f();
   }
+
+  /* calls 'func' once everything is done, without blocking the caller */
+  void then(std::function<void(void)> func) {
+    LOG_DEBUG("joinable::then()\n");
+
+    if (then_f)
+      then_f(func);
+    else
+      func();
+  }
 };
 
 class joinables {
@@ -46,7 +46,12 @@ namespace parallel_f {
 #endif
 
 #if PARALLEL_F__DEBUG_ENABLED
-#define LOG_DEBUG(...) parallel_f::log_debug(__VA_ARGS__)
+/* arguments like get_name().c_str() are only evaluated with debug output on */
+#define LOG_DEBUG(...)                                                         \
+  do {                                                                         \
+    if (parallel_f::debug_active())                                            \
+      parallel_f::log_debug(__VA_ARGS__);                                      \
+  } while (0)
 #else
 #define LOG_DEBUG(...)                                                         \
   do {                                                                         \
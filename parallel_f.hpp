@@ -4,22 +4,26 @@
 #pragma once
 
 #include <any>
+#include <chrono>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <queue>
 #include <tuple>
 
 #include "log.hpp"
+#include "slab_pool.hpp"
 #include "stats.hpp"
 #include "system.hpp"
 #include "vthread.hpp"
 
-#include "Event.hxx"
-
 #include "joinable.hpp"
+#include "static_graph.hpp"
 #include "task.hpp"
+#include "task_group.hpp"
 #include "task_node.hpp"
+#include "window.hpp"
 
 namespace parallel_f {
 
@@ -27,9 +31,45 @@ namespace core {
 
 static const std::any none;
 
+/**
+ * Generates a task object in memory from the given allocator, e.g. a
+ * std::pmr::polymorphic_allocator for a memory resource of the caller.
+ *
+ *     static std::pmr::synchronized_pool_resource pool;
+ *
+ *     auto t = parallel_f::make_task(
+ *         std::allocator_arg, std::pmr::polymorphic_allocator<>(&pool), func);
+ *
+ * The task may be released on any worker, even shortly after it has been
+ * joined, so the allocator has to be thread safe and outlive the executor's
+ * use of the task.
+ *
+ * @param alloc The allocator for the task and its reference count.
+ * @param callable The function or callable object to be executed by the task.
+ * @param args The arguments to be passed to the callable.
+ *
+ * @return A shared pointer to a task object that wraps the callable and
+ * arguments.
+ */
+template <typename Alloc, typename Callable, typename... Args>
+auto make_task(std::allocator_arg_t, Alloc alloc, Callable &&callable,
+               Args &&...args) {
+  /* one allocation for the task and its reference count */
+  return std::allocate_shared<
+      task<std::decay_t<Callable>, std::decay_t<Args>...>>(
+      alloc, std::in_place, std::forward<Callable>(callable),
+      std::forward<Args>(args)...);
+}
+
 /**
  * Generates a task object using the provided callable and arguments.
  *
+ * The callable and arguments are forwarded into the task, so rvalues are
+ * moved instead of copied and may be move-only, e.g. a std::unique_ptr. The
+ * task stores them decayed and moves them into the call when it runs.
+ *
+ * The task's memory comes from the slab_pool of the calling thread.
+ *
  * @param callable The function or callable object to be executed by the task.
  * @param args The arguments to be passed to the callable.
  *
@@ -39,39 +79,183 @@ static const std::any none;
  * @throws None
  */
 template <typename Callable, typename... Args>
-auto make_task(Callable callable, Args... args) {
-  return std::shared_ptr<task<Callable, Args...>>(
-      new task<Callable, Args...>(callable, std::forward<Args>(args)...));
+auto make_task(Callable &&callable, Args &&...args) {
+  return make_task(std::allocator_arg,
+                   std::pmr::polymorphic_allocator<std::byte>(&slab_pool::get()),
+                   std::forward<Callable>(callable),
+                   std::forward<Args>(args)...);
+}
+
+/**
+ * Generates a task object running with the given scheduling priority.
+ *
+ * @param prio The priority class of the vthread executing the task.
+ * @param callable The function or callable object to be executed by the task.
+ * @param args The arguments to be passed to the callable.
+ *
+ * @return A shared pointer to a task object that wraps the callable and
+ * arguments.
+ */
+template <typename Callable, typename... Args>
+auto make_task(priority prio, Callable &&callable, Args &&...args) {
+  auto t = make_task(std::forward<Callable>(callable),
+                     std::forward<Args>(args)...);
+
+  t->set_priority(prio);
+
+  return t;
+}
+
+/**
+ * Generates a hedged task object, which is raced against a copy of itself
+ * when it runs for longer than usual, so it has to be idempotent.
+ *
+ * @param callable The function or callable object to be executed by the task.
+ * @param args The arguments to be passed to the callable.
+ *
+ * @return A shared pointer to a task object that wraps the callable and
+ * arguments.
+ */
+template <typename Callable, typename... Args>
+auto make_task(hedge_t, Callable &&callable, Args &&...args) {
+  auto t = make_task(std::forward<Callable>(callable),
+                     std::forward<Args>(args)...);
+
+  t->set_hedged(true);
+
+  return t;
+}
+
+/**
+ * Generates a task object with an affinity to the data it works on, so tasks
+ * with the same key preferably run on the same worker.
+ *
+ * @param a The key, e.g. parallel_f::affinity(object) for an object pointer.
+ * @param callable The function or callable object to be executed by the task.
+ * @param args The arguments to be passed to the callable.
+ *
+ * @return A shared pointer to a task object that wraps the callable and
+ * arguments.
+ */
+template <typename Callable, typename... Args>
+auto make_task(affinity a, Callable &&callable, Args &&...args) {
+  auto t = make_task(std::forward<Callable>(callable),
+                     std::forward<Args>(args)...);
+
+  t->set_affinity(a);
+
+  return t;
 }
 
 // parallel_f :: task_queue == implementation
 
 class task_queue {
 private:
+  executor *target;
+  std::pmr::memory_resource *resource;
+  cancel_token token;
+  std::chrono::steady_clock::time_point deadline;
+  std::shared_ptr<details::window> window;
   std::shared_ptr<details::task_node> first;
   std::shared_ptr<details::task_node> last;
   std::mutex mutex;
 
 public:
-  task_queue() {}
+  task_queue() : target(nullptr), resource(&slab_pool::get()) {}
+
+  /* runs the tasks on 'exec' instead of the default executor */
+  explicit task_queue(executor &exec)
+      : target(&exec), resource(&slab_pool::get()) {}
+
+  /* allocates the nodes running the tasks from 'resource', which has to be
+   * thread safe and outlive them, i.e. the queue and the executor running it,
+   * as nodes may be released by a worker shortly after exec() returned */
+  explicit task_queue(std::pmr::memory_resource *resource)
+      : target(nullptr), resource(resource) {}
+
+  task_queue(executor &exec, std::pmr::memory_resource *resource)
+      : target(&exec), resource(resource) {}
+
+  /* applies to tasks pushed afterwards which don't have a token yet */
+  void set_cancel_token(cancel_token t) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    token = t;
+  }
+
+  /* applies to tasks pushed afterwards, a default constructed time point for
+   * none, which is needed for tasks started early by the window, see exec() */
+  void set_deadline(std::chrono::steady_clock::time_point d) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    deadline = d;
+  }
+
+  /*
+   * Limits the tasks pushed but not finished yet, by count and by their
+   * declared cost (zero for no limit). When the limit is hit, the tasks pushed
+   * so far are started without waiting for exec() and push() applies 'mode',
+   * while try_push() returns false. Tasks pushed after that are started as
+   * soon as their predecessor is finished.
+   */
+  void set_window(size_t max_tasks, size_t max_bytes = 0,
+                  backpressure mode = backpressure::block) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    window = std::make_shared<details::window>(max_tasks, max_bytes, mode);
+  }
 
   void push(std::shared_ptr<task_base> task) {
     LOG_DEBUG("task_queue::push()\n");
 
     std::unique_lock<std::mutex> lock(mutex);
 
-    if (first) {
-      auto node = std::make_shared<details::task_node>("task", task, 1);
+    if (window && !window->try_acquire(task->get_cost())) {
+      kick();
 
-      last->add_to_notify(node);
+      auto w = window;
 
-      last = node;
-    } else {
-      auto node = std::make_shared<details::task_node>("first", task, 1);
+      lock.unlock();
 
-      first = node;
-      last = node;
+      w->acquire(task->get_cost());
+
+      lock.lock();
+    }
+
+    enqueue(std::move(task));
+  }
+
+  /* returns false if the window is full */
+  bool try_push(std::shared_ptr<task_base> task) {
+    LOG_DEBUG("task_queue::try_push()\n");
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (window && !window->try_acquire(task->get_cost())) {
+      kick();
+
+      return false;
     }
+
+    enqueue(task);
+
+    return true;
+  }
+
+  /* like exec(), with the tasks being scheduled earliest deadline first, except
+   * those already started by the window, see set_deadline() */
+  joinable exec(std::chrono::steady_clock::time_point d,
+                bool detached = false) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    /* the chain from 'first' is not started yet */
+    for (auto node = first; node;
+         node = node == last ? nullptr : node->get_next())
+      node->set_deadline(d);
+
+    lock.unlock();
+
+    return exec(detached);
   }
 
   joinable exec(bool detached = false) {
@@ -87,7 +271,9 @@ public:
 
     lock.unlock();
 
-    f->notify();
+    /* already started if the window was hit */
+    if (f)
+      f->notify();
 
     if (!detached) {
       l->join();
@@ -95,11 +281,51 @@ public:
       return joinable();
     }
 
-    return joinable([f, l]() { l->join(); });
+    return joinable([f, l]() { l->join(); },
+                    [f, l](std::function<void(void)> func) {
+                      l->on_finished(func);
+                    });
+  }
+
+private:
+  void enqueue(std::shared_ptr<task_base> task) {
+    if (token && !task->get_cancel_token())
+      task->set_cancel_token(token);
+
+    auto node = details::task_node::make(resource, last ? "task" : "first",
+                                         task, 1, target);
+
+    /* before a predecessor may start it */
+    if (deadline.time_since_epoch().count())
+      node->set_deadline(deadline);
+
+    if (last)
+      last->add_to_notify(node);
+    else
+      first = node;
+
+    last = node;
+
+    if (window) {
+      auto w = window;
+      size_t cost = task->get_cost();
+
+      node->on_finished([w, cost]() { w->release(cost); });
+    }
+  }
+
+  /* starts the tasks pushed so far, the chain stays open for more */
+  void kick() {
+    LOG_DEBUG("task_queue::kick()\n");
+
+    if (first)
+      first->notify();
+
+    first.reset();
   }
 };
 
-class task_queue_simple : public events::event_listener {
+class task_queue_simple {
 private:
   std::vector<std::shared_ptr<task_base>> tasks;
   std::mutex lock;
@@ -133,25 +359,37 @@ private:
   void run(std::vector<std::shared_ptr<task_base>> &q) {
     for (auto t : q) {
       if (!t->finish()) {
-        std::mutex lock;
-        std::condition_variable cond;
-        bool finished = false;
+        waiter w;
 
-        std::unique_lock<std::mutex> l(lock);
+        t->attach(&w);
 
-        t->finished.attach(this, [&lock, &cond, &finished](int) {
-          std::unique_lock<std::mutex> l(lock);
+        w.wait();
+      }
+    }
+  }
 
-          finished = true;
+  class waiter : public task_base::observer {
+  private:
+    std::mutex lock;
+    std::condition_variable cond;
+    bool finished = false;
 
-          cond.notify_one();
-        });
+  public:
+    void completed() {
+      std::unique_lock<std::mutex> l(lock);
 
-        while (!finished && t->get_state() != task_base::task_state::FINISHED)
-          cond.wait(l);
-      }
+      finished = true;
+
+      cond.notify_one();
     }
-  }
+
+    void wait() {
+      std::unique_lock<std::mutex> l(lock);
+
+      while (!finished)
+        cond.wait(l);
+    }
+  };
 };
 
 // parallel_f :: task_list == implementation
@@ -160,58 +398,141 @@ typedef unsigned long long task_id;
 
 class task_list {
 private:
+  executor *target;
+  std::pmr::memory_resource *resource;
+  cancel_token token;
+  std::shared_ptr<details::window> window;
   task_id ids;
-  std::map<task_id, std::shared_ptr<details::task_node>> nodes;
+  std::pmr::map<task_id, std::shared_ptr<details::task_node>> nodes;
+  std::vector<task_id> retired; // see admit()
   std::mutex mutex;
   std::shared_ptr<details::task_node> flush_join;
 
 public:
-  task_list() : ids(0), flush_join(0) {
+  task_list()
+      : target(nullptr), resource(&slab_pool::get()), ids(0),
+        nodes(resource), flush_join(0) {
+    LOG_DEBUG("task_list::task_list(%p)\n", this);
+  }
+
+  /* runs the tasks on 'exec' instead of the default executor, dependencies
+   * may still refer to tasks of lists running elsewhere */
+  explicit task_list(executor &exec)
+      : target(&exec), resource(&slab_pool::get()), ids(0),
+        nodes(resource), flush_join(0) {
+    LOG_DEBUG("task_list::task_list(%p, '%s')\n", this,
+              exec.get_name().c_str());
+  }
+
+  /* allocates the nodes running the tasks, their bookkeeping and flush()
+   * tasks from 'resource', which has to be thread safe and outlive them, see
+   * task_queue */
+  explicit task_list(std::pmr::memory_resource *resource)
+      : target(nullptr), resource(resource), ids(0), nodes(resource),
+        flush_join(0) {
     LOG_DEBUG("task_list::task_list(%p)\n", this);
   }
 
+  task_list(executor &exec, std::pmr::memory_resource *resource)
+      : target(&exec), resource(resource), ids(0), nodes(resource),
+        flush_join(0) {
+    LOG_DEBUG("task_list::task_list(%p, '%s')\n", this,
+              exec.get_name().c_str());
+  }
+
   ~task_list() { LOG_DEBUG("task_list::~task_list(%p)\n", this); }
 
+  /*
+   * Applies to tasks appended afterwards which don't have a token yet. Once
+   * cancelled, tasks not started so far are skipped, which completes them
+   * for their dependents (skipped as well if they share the token) and joins.
+   */
+  void set_cancel_token(cancel_token t) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    token = t;
+  }
+
+  /*
+   * Limits the tasks appended but not finished yet, by count and by their
+   * declared cost (zero for no limit). When the limit is hit, the tasks
+   * appended so far are started without waiting for finish() and append()
+   * applies 'mode', while try_append() returns zero. Finished tasks are then
+   * dropped from the list, dependencies on them are met right away.
+   */
+  void set_window(size_t max_tasks, size_t max_bytes = 0,
+                  backpressure mode = backpressure::block) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    window = std::make_shared<details::window>(max_tasks, max_bytes, mode);
+  }
+
   task_id append(std::shared_ptr<task_base> task) {
     LOG_DEBUG("task_list::append( no dependencies )\n");
 
     std::unique_lock<std::mutex> lock(mutex);
 
+    admit(task, lock, true);
+
+    if (token && !task->get_cancel_token())
+      task->set_cancel_token(token);
+
     task_id id = ++ids;
 
-    nodes[id] = std::make_shared<details::task_node>("task", task, 1);
+    nodes[id] = details::task_node::make(resource, "task", task, 1, target);
+
+    track(id, task);
 
     return id;
   }
 
   template <typename... Deps>
-  task_id append(std::shared_ptr<task_base> task, Deps... deps) {
-    LOG_DEBUG("task_list::append( %d dependencies )\n", sizeof...(deps));
+  task_id append(std::shared_ptr<task_base> task, priority prio,
+                 Deps... deps) {
+    task->set_priority(prio);
 
-    std::unique_lock<std::mutex> lock(mutex);
+    if constexpr (sizeof...(deps) == 0)
+      return append(task);
+    else
+      return append(task, deps...);
+  }
 
-    task_id id = ++ids;
+  template <typename... Deps>
+  task_id append(std::shared_ptr<task_base> task, affinity a, Deps... deps) {
+    task->set_affinity(a);
 
-    std::shared_ptr<details::task_node> node =
-        std::make_shared<details::task_node>(
-            "task", task, (unsigned int)(1 + sizeof...(deps)));
+    if constexpr (sizeof...(deps) == 0)
+      return append(task);
+    else
+      return append(task, deps...);
+  }
 
-    std::list<task_id> deps_list({deps...});
+  template <typename... Deps>
+  task_id append(std::shared_ptr<task_base> task, Deps... deps) {
+    LOG_DEBUG("task_list::append( %d dependencies )\n", sizeof...(deps));
 
-    for (auto li : deps_list) {
-      LOG_DEBUG("task_list::append()  <- id %llu\n", li);
+    return insert(true, task, deps...);
+  }
 
-      auto dep = nodes.find(li);
+  /* returns zero instead of waiting if the window is full */
+  template <typename... Deps>
+  task_id try_append(std::shared_ptr<task_base> task, Deps... deps) {
+    LOG_DEBUG("task_list::try_append( %d dependencies )\n", sizeof...(deps));
 
-      if (dep != nodes.end())
-        (*dep).second->add_to_notify(node);
-      else
-        node->notify();
-    }
+    return insert(false, task, deps...);
+  }
 
-    nodes[id] = node;
+  /* like finish(), with the tasks being scheduled earliest deadline first */
+  joinable finish(std::chrono::steady_clock::time_point deadline,
+                  bool detached = false) {
+    std::unique_lock<std::mutex> lock(mutex);
 
-    return id;
+    for (auto &node : nodes)
+      node.second->set_deadline(deadline);
+
+    lock.unlock();
+
+    return finish(detached);
   }
 
   joinable finish(bool detached = false) {
@@ -227,11 +548,15 @@ public:
 
     for (auto node : nodes) {
       if (node.second != flush_join)
-        node.second->notify();
+        node.second->release();
     }
 
     flush_join.reset();
 
+    /* none of them are tracked anymore */
+    if (window)
+      window->forget(ids);
+
     if (!detached) {
       for (auto node : nodes)
         node.second->join();
@@ -241,14 +566,30 @@ public:
       return joinable();
     }
 
-    auto n = nodes;
+    /* shared by both functions, keeping the resource */
+    auto n = std::allocate_shared<decltype(nodes)>(
+        std::pmr::polymorphic_allocator<std::byte>(resource), std::move(nodes));
 
     nodes.clear();
 
-    return joinable([n]() {
-      for (auto node : n)
-        node.second->join();
-    });
+    return joinable(
+        [n]() {
+          for (auto &node : *n)
+            node.second->join();
+        },
+        [n](std::function<void(void)> func) {
+          auto pending = std::make_shared<std::atomic<size_t>>(n->size() + 1);
+
+          auto done = [pending, func]() {
+            if (!--*pending)
+              func();
+          };
+
+          for (auto &node : *n)
+            node.second->on_finished(done);
+
+          done();
+        });
   }
 
   task_id flush() {
@@ -258,12 +599,17 @@ public:
 
     std::shared_ptr<details::task_node> prev_flush_join = flush_join;
 
+    auto task = make_task(std::allocator_arg,
+                          std::pmr::polymorphic_allocator<std::byte>(resource),
+                          []() {});
+
     if (flush_join)
-      flush_join = std::make_shared<details::task_node>(
-          "flush", make_task([]() {}), (unsigned int)(1 + nodes.size() - 1));
+      flush_join = details::task_node::make(
+          resource, "flush", task, (unsigned int)(1 + nodes.size() - 1),
+          target);
     else
-      flush_join = std::make_shared<details::task_node>(
-          "flush", make_task([]() {}), (unsigned int)(1 + nodes.size()));
+      flush_join = details::task_node::make(
+          resource, "flush", task, (unsigned int)(1 + nodes.size()), target);
 
     if (prev_flush_join) {
       LOG_DEBUG("task_list::flush() joining previous flush...\n");
@@ -277,7 +623,7 @@ public:
       if (node.second != prev_flush_join) {
         node.second->add_to_notify(flush_join);
 
-        node.second->notify();
+        node.second->release();
       }
     }
 
@@ -285,13 +631,16 @@ public:
 
     nodes.clear();
 
+    if (window)
+      window->forget(ids);
+
     LOG_DEBUG("task_list::flush() clearing nodes done.\n");
 
     task_id flush_id = ++ids;
 
     nodes[flush_id] = flush_join;
 
-    flush_join->notify();
+    flush_join->release();
 
     LOG_DEBUG("task_list::flush() done.\n");
 
@@ -299,6 +648,93 @@ public:
   }
 
   size_t length() const { return nodes.size(); }
+
+private:
+  template <typename... Deps>
+  task_id insert(bool wait, std::shared_ptr<task_base> task, Deps... deps) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (!admit(task, lock, wait))
+      return 0;
+
+    if (token && !task->get_cancel_token())
+      task->set_cancel_token(token);
+
+    task_id id = ++ids;
+
+    std::shared_ptr<details::task_node> node = details::task_node::make(
+        resource, "task", task, (unsigned int)(1 + sizeof...(deps)), target);
+
+    std::initializer_list<task_id> deps_list = {(task_id)deps...};
+
+    for (auto li : deps_list) {
+      LOG_DEBUG("task_list::append()  <- id %llu\n", li);
+
+      auto dep = nodes.find(li);
+
+      if (dep != nodes.end())
+        (*dep).second->add_to_notify(node);
+      else
+        node->notify();
+    }
+
+    nodes[id] = node;
+
+    track(id, task);
+
+    return id;
+  }
+
+  /* takes room in the window, 'lock' is released while waiting for it */
+  bool admit(std::shared_ptr<task_base> task,
+             std::unique_lock<std::mutex> &lock, bool wait) {
+    if (!window)
+      return true;
+
+    /* drop finished tasks, their dependents are notified right away */
+    window->take_retired(retired);
+
+    for (auto id : retired)
+      nodes.erase(id);
+
+    if (window->try_acquire(task->get_cost()))
+      return true;
+
+    kick();
+
+    if (!wait)
+      return false;
+
+    auto w = window;
+
+    lock.unlock();
+
+    w->acquire(task->get_cost());
+
+    lock.lock();
+
+    return true;
+  }
+
+  void track(task_id id, std::shared_ptr<task_base> task) {
+    if (!window)
+      return;
+
+    auto w = window;
+    size_t cost = task->get_cost();
+
+    nodes[id]->on_finished([w, cost, id]() { w->release(cost, id); });
+  }
+
+  /* starts the tasks appended so far, so the window drains */
+  void kick() {
+    LOG_DEBUG("task_list::kick()\n");
+
+    for (auto node : nodes) {
+      if (node.second != flush_join)
+        node.second->release();
+    }
+  }
 };
 
 } // namespace core
@@ -312,3 +748,5 @@ using core::task_queue;
 using core::task_queue_simple;
 
 } // namespace parallel_f
+
+#include "co_task.hpp"
@@ -0,0 +1,34 @@
+// === (C) 2020-2024 === parallel_f / priority (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+namespace parallel_f {
+
+// parallel_f :: priority == implementation
+
+/*
+ * Scheduling classes served by the vthread manager.
+ *
+ * Ready work is served by strict priority, except for lower classes which
+ * have not been served for longer than the aging period (see
+ * vthread::set_aging), so background work is never starved completely.
+ */
+enum class priority : unsigned int { realtime, normal, background };
+
+static const unsigned int priority_count = 3;
+
+static inline const char *priority_name(priority p) {
+  switch (p) {
+  case priority::realtime:
+    return "realtime";
+  case priority::normal:
+    return "normal";
+  case priority::background:
+    return "background";
+  }
+
+  return "unknown";
+}
+
+} // namespace parallel_f
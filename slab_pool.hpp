@@ -0,0 +1,303 @@
+// === (C) 2020-2024 === parallel_f / slab_pool (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "unique_function.hpp"
+
+namespace parallel_f {
+
+namespace details {
+
+/* a free block, linked through its first bytes */
+class slab_block {
+public:
+  slab_block *next;
+};
+
+class slab_cache;
+
+/* at the start of each slab, which is aligned to its size */
+class alignas(64) slab_header {
+public:
+  slab_cache *owner;
+  slab_header *next_slab;
+};
+
+/*
+ * Free blocks of one thread, per size class.
+ *
+ * Only the owning thread takes blocks and frees its own ones into 'local'.
+ * Other threads collect frees per owner in 'pending' and hand over a batch at
+ * once to the owner's 'remote' list, which the owner takes with one exchange
+ * when 'local' runs empty.
+ */
+class slab_cache {
+public:
+  static constexpr size_t granularity = 64;
+  static constexpr size_t classes = 16; /* 64 .. 1024 bytes */
+  static constexpr size_t slab_size = 64 * 1024;
+  static constexpr unsigned int batch = 32;
+
+private:
+  class pending_frees {
+  public:
+    slab_cache *owner = nullptr;
+    slab_block *head = nullptr;
+    slab_block *tail = nullptr;
+    unsigned int count = 0;
+  };
+
+  slab_block *local[classes] = {};
+  std::atomic<slab_block *> remote[classes] = {};
+  pending_frees pending[classes];
+  slab_header *slabs = nullptr;
+
+public:
+  /* zero bytes (legal for a memory_resource) take the smallest class */
+  static size_t size_class(size_t bytes) {
+    return bytes ? (bytes + granularity - 1) / granularity - 1 : 0;
+  }
+
+  static slab_cache *owner_of(void *p) {
+    return reinterpret_cast<slab_header *>(reinterpret_cast<uintptr_t>(p) &
+                                           ~uintptr_t(slab_size - 1))
+        ->owner;
+  }
+
+  void *allocate(size_t c) {
+    if (!local[c])
+      local[c] = remote[c].exchange(nullptr, std::memory_order_acquire);
+
+    if (!local[c])
+      refill(c);
+
+    slab_block *b = local[c];
+
+    local[c] = b->next;
+
+    return b;
+  }
+
+  void deallocate(void *p, size_t c) {
+    slab_cache *owner = owner_of(p);
+    slab_block *b = static_cast<slab_block *>(p);
+
+    if (owner == this) {
+      b->next = local[c];
+      local[c] = b;
+      return;
+    }
+
+    pending_frees &f = pending[c];
+
+    if (f.owner != owner)
+      flush(c);
+
+    b->next = f.head;
+    f.head = b;
+
+    if (!f.count++) {
+      f.owner = owner;
+      f.tail = b;
+    }
+
+    if (f.count == batch)
+      flush(c);
+  }
+
+  /* before the cache changes hands, blocks of others are not kept back */
+  void flush() {
+    for (size_t c = 0; c < classes; c++)
+      flush(c);
+  }
+
+  /* hands over 'head' .. 'tail' freed by another thread, or one block */
+  void give_back(size_t c, slab_block *head, slab_block *tail) {
+    slab_block *h = remote[c].load(std::memory_order_relaxed);
+
+    do {
+      tail->next = h;
+    } while (!remote[c].compare_exchange_weak(
+        h, head, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+private:
+  void flush(size_t c) {
+    pending_frees &f = pending[c];
+
+    if (f.count)
+      f.owner->give_back(c, f.head, f.tail);
+
+    f = pending_frees();
+  }
+
+  void refill(size_t c) {
+    heap_allocs->add();
+
+    auto slab = static_cast<slab_header *>(
+        ::operator new(slab_size, std::align_val_t(slab_size)));
+
+    slab->owner = this;
+    slab->next_slab = slabs;
+    slabs = slab;
+
+    size_t size = (c + 1) * granularity;
+    char *end = reinterpret_cast<char *>(slab) + slab_size;
+
+    for (char *p = reinterpret_cast<char *>(slab + 1); p + size <= end;
+         p += size) {
+      slab_block *b = reinterpret_cast<slab_block *>(p);
+
+      b->next = local[c];
+      local[c] = b;
+    }
+  }
+};
+
+} // namespace details
+
+// parallel_f :: slab_pool == implementation
+
+/*
+ * Memory resource recycling task and node memory per thread, used by default
+ * for make_task() and the nodes of task_queue and task_list.
+ *
+ * Requests of up to 1024 bytes with an alignment of up to 64 are served from
+ * 64 KiB slabs of the calling thread, i.e. the worker, in classes of 64 bytes.
+ * Memory freed on another thread returns to the owner in batches. Slabs are
+ * kept for reuse, a thread's cache is taken over by the next thread after it
+ * exits. New slabs and larger requests are counted as 'alloc.heap'.
+ */
+class slab_pool : public std::pmr::memory_resource {
+private:
+  static inline thread_local details::slab_cache *current = nullptr;
+  static inline thread_local bool exiting = false;
+
+  /* owns the thread's cache until the thread exits */
+  class thread_slot {
+  public:
+    thread_slot() { current = take(); }
+
+    ~thread_slot() {
+      exiting = true;
+
+      put(current);
+
+      current = nullptr;
+    }
+  };
+
+public:
+  /* never destroyed, memory may be returned late during exit */
+  static slab_pool &get() {
+    static auto pool = new slab_pool();
+
+    return *pool;
+  }
+
+protected:
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    if (bytes > details::slab_cache::classes * details::slab_cache::granularity ||
+        alignment > details::slab_cache::granularity) {
+      details::heap_allocs->add();
+
+      return ::operator new(bytes, std::align_val_t(alignment));
+    }
+
+    size_t c = details::slab_cache::size_class(bytes);
+    details::slab_cache *cache = local();
+
+    if (cache)
+      return cache->allocate(c);
+
+    /* while the thread exits, borrow a cache */
+    cache = take();
+
+    void *p = cache->allocate(c);
+
+    put(cache);
+
+    return p;
+  }
+
+  void do_deallocate(void *p, size_t bytes, size_t alignment) override {
+    if (bytes > details::slab_cache::classes * details::slab_cache::granularity ||
+        alignment > details::slab_cache::granularity) {
+      ::operator delete(p, std::align_val_t(alignment));
+      return;
+    }
+
+    size_t c = details::slab_cache::size_class(bytes);
+    details::slab_cache *cache = local();
+
+    if (cache) {
+      cache->deallocate(p, c);
+      return;
+    }
+
+    /* while the thread exits, straight back to the owner */
+    auto b = static_cast<details::slab_block *>(p);
+
+    details::slab_cache::owner_of(p)->give_back(c, b, b);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const
+      noexcept override {
+    return this == &other;
+  }
+
+private:
+  static details::slab_cache *local() {
+    if (current || exiting)
+      return current;
+
+    thread_local thread_slot slot;
+
+    return current;
+  }
+
+  /* caches of exited threads, never freed as blocks may still be out */
+  static std::mutex &spare_lock() {
+    static auto lock = new std::mutex();
+
+    return *lock;
+  }
+
+  static std::vector<details::slab_cache *> &spare() {
+    static auto caches = new std::vector<details::slab_cache *>();
+
+    return *caches;
+  }
+
+  static details::slab_cache *take() {
+    std::unique_lock<std::mutex> l(spare_lock());
+
+    if (spare().empty())
+      return new details::slab_cache();
+
+    details::slab_cache *cache = spare().back();
+
+    spare().pop_back();
+
+    return cache;
+  }
+
+  static void put(details::slab_cache *cache) {
+    cache->flush();
+
+    std::unique_lock<std::mutex> l(spare_lock());
+
+    spare().push_back(cache);
+  }
+};
+
+} // namespace parallel_f
@@ -0,0 +1,338 @@
+// === (C) 2020-2024 === parallel_f / static_graph (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "job.hpp"
+#include "joinable.hpp"
+#include "log.hpp"
+#include "task_base.hpp"
+#include "vthread.hpp"
+
+namespace parallel_f {
+
+/* node 'Id' of a static_graph, run after the nodes 'Deps' */
+template <size_t Id, size_t... Deps> class node {
+public:
+  static constexpr size_t id = Id;
+  static constexpr size_t dep_count = sizeof...(Deps);
+  static constexpr std::array<size_t, sizeof...(Deps)> deps = {{Deps...}};
+};
+
+namespace details {
+
+/* wait counts and successor lists of a static_graph, built at compile time */
+template <typename... Nodes> class graph_layout {
+public:
+  static constexpr size_t size = sizeof...(Nodes);
+  static constexpr size_t edge_count = (Nodes::dep_count + ... + 0);
+
+  std::array<unsigned int, size> waits;
+
+  /* successors of node 'i' are next[first[i]] .. next[first[i + 1] - 1] */
+  std::array<size_t, size + 1> first;
+  std::array<size_t, edge_count> next;
+
+  static constexpr bool valid() {
+    size_t i = 0;
+
+    return ((Nodes::id == i++ && ordered<Nodes>()) && ... && true);
+  }
+
+  static constexpr graph_layout make() {
+    graph_layout l{};
+
+    ((l.waits[Nodes::id] = Nodes::dep_count), ...);
+
+    (count<Nodes>(l), ...);
+
+    for (size_t i = 0; i < size; i++)
+      l.first[i + 1] += l.first[i];
+
+    std::array<size_t, size + 1> fill = l.first;
+
+    (place<Nodes>(l, fill), ...);
+
+    return l;
+  }
+
+private:
+  template <typename N> static constexpr bool ordered() {
+    for (size_t d : N::deps) {
+      if (d >= N::id)
+        return false;
+    }
+
+    return true;
+  }
+
+  template <typename N> static constexpr void count(graph_layout &l) {
+    for (size_t d : N::deps)
+      l.first[d + 1]++;
+  }
+
+  template <typename N>
+  static constexpr void place(graph_layout &l,
+                              std::array<size_t, size + 1> &fill) {
+    for (size_t d : N::deps)
+      l.next[fill[d]++] = N::id;
+  }
+};
+
+} // namespace details
+
+// parallel_f :: static_graph == implementation
+
+/*
+ * Task graph with a shape fixed at compile time, e.g. a diamond
+ *
+ *     typedef parallel_f::static_graph<parallel_f::node<0>,
+ *                                      parallel_f::node<1, 0>,
+ *                                      parallel_f::node<2, 0>,
+ *                                      parallel_f::node<3, 1, 2>>
+ *         diamond;
+ *
+ *     diamond g(load, left, right, merge);
+ *
+ *     g.finish();
+ *
+ * Nodes are numbered in order and depend on earlier ones only, so the graph
+ * is acyclic by construction. Wait counts and successor lists are computed by
+ * the compiler into flat arrays. Running the graph allocates nothing: each
+ * node observes its task and is pushed as a job onto the workers' deques
+ * once its last dependency has finished, counted down with atomics. Only when
+ * finish() is called outside of managed threads, one vthread is started for
+ * launching the nodes without dependencies.
+ *
+ * finish() works like task_list::finish(), except that the graph runs once.
+ * The graph has to outlive the joinable it returns, its destructor joins.
+ * Tasks whose cancel_token has been cancelled are skipped when they become
+ * ready, which completes them for their dependents. 'exec' runs nodes made
+ * ready outside of managed threads, nullptr for the default executor.
+ */
+template <typename... Nodes> class static_graph {
+public:
+  static constexpr size_t size = sizeof...(Nodes);
+
+private:
+  typedef details::graph_layout<Nodes...> layout_type;
+
+  static_assert(size > 0, "static_graph: no nodes");
+  static_assert(layout_type::valid(),
+                "static_graph: nodes must be numbered 0, 1, ... in order and "
+                "depend on earlier ones only");
+
+  static constexpr layout_type layout = layout_type::make();
+
+  class vertex : public details::job, public task_base::observer {
+  public:
+    static_graph *graph;
+    std::atomic<unsigned int> wait;
+
+    void completed() { graph->completed(this); }
+  };
+
+  /* makes the nodes without dependencies ready from a worker, so they are
+   * pushed onto its deque instead of getting a vthread each */
+  class launcher : public details::job {
+  public:
+    static_graph *graph;
+  };
+
+  std::array<std::shared_ptr<task_base>, size> tasks;
+  std::array<vertex, size> vertices;
+  launcher launch;
+  executor *exec;
+  std::atomic<size_t> remaining;
+  bool started;
+  bool complete;
+  std::mutex lock;
+  std::condition_variable cond;
+  std::vector<std::shared_ptr<vthread>> joiners;
+  std::vector<std::function<void(void)>> continuations;
+
+public:
+  explicit static_graph(std::array<std::shared_ptr<task_base>, size> tasks,
+                        executor *exec = nullptr)
+      : tasks(std::move(tasks)), exec(exec), remaining(size), started(false),
+        complete(false) {
+    for (auto &v : vertices) {
+      v.func = run;
+      v.graph = this;
+    }
+
+    launch.func = run_roots;
+    launch.prio = priority::normal;
+    launch.graph = this;
+  }
+
+  /* one task per node, in the order of the nodes */
+  template <typename... Tasks,
+            typename = std::enable_if_t<sizeof...(Tasks) == size>>
+  explicit static_graph(std::shared_ptr<Tasks>... tasks)
+      : static_graph(
+            std::array<std::shared_ptr<task_base>, size>{{std::move(tasks)...}}) {
+  }
+
+  ~static_graph() {
+    if (started)
+      join();
+  }
+
+  static_graph(const static_graph &) = delete;
+  static_graph &operator=(const static_graph &) = delete;
+
+  joinable finish(bool detached = false) {
+    LOG_DEBUG("static_graph::finish(%s)\n", detached ? "true" : "false");
+
+    start();
+
+    if (!detached) {
+      join();
+
+      return joinable();
+    }
+
+    return joinable([this]() { join(); },
+                    [this](std::function<void(void)> func) {
+                      then(std::move(func));
+                    });
+  }
+
+private:
+  void start() {
+    if (started)
+      return;
+
+    started = true;
+
+    for (size_t i = 0; i < size; i++)
+      vertices[i].wait.store(layout.waits[i], std::memory_order_relaxed);
+
+    /* tasks finished already complete their nodes right away */
+    for (size_t i = 0; i < size; i++)
+      tasks[i]->attach(&vertices[i]);
+
+    if (!executor::push_job(&launch))
+      (exec ? *exec : executor::instance()).start_job(&launch);
+  }
+
+  static void run_roots(details::job *j) {
+    static_graph *g = static_cast<launcher *>(j)->graph;
+
+    /* only reads the layout after the last one, the graph may be gone */
+    for (size_t i = 0; i < size; i++) {
+      if (!layout.waits[i])
+        g->ready(i);
+    }
+  }
+
+  void ready(size_t i) {
+    /* the graph may be gone once the task is finished */
+    std::shared_ptr<task_base> t = tasks[i];
+
+    if (t->get_cancel_token().is_cancelled()) {
+      t->cancel();
+      return;
+    }
+
+    vertex &v = vertices[i];
+
+    v.prio = t->get_priority();
+
+    if (!executor::push_job(&v))
+      (exec ? *exec : executor::instance()).start_job(&v);
+  }
+
+  static void run(details::job *j) {
+    vertex *v = static_cast<vertex *>(j);
+    static_graph *g = v->graph;
+
+    std::shared_ptr<task_base> t = g->tasks[v - g->vertices.data()];
+
+    /* tasks finishing asynchronously complete their node later */
+    t->finish();
+  }
+
+  void completed(vertex *v) {
+    size_t i = v - vertices.data();
+
+    for (size_t k = layout.first[i]; k < layout.first[i + 1]; k++) {
+      size_t s = layout.next[k];
+
+      if (vertices[s].wait.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        ready(s);
+    }
+
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      done();
+  }
+
+  void done() {
+    std::unique_lock<std::mutex> l(lock);
+
+    complete = true;
+
+    cond.notify_all();
+
+    std::vector<std::shared_ptr<vthread>> j = std::move(joiners);
+    std::vector<std::function<void(void)>> c = std::move(continuations);
+
+    /* the graph may be gone once the lock is released */
+    l.unlock();
+
+    for (auto &t : j)
+      vthread::resume(std::move(t));
+
+    for (auto &func : c)
+      func();
+  }
+
+  void join() {
+    std::unique_lock<std::mutex> l(lock);
+
+    while (!complete) {
+      if (vthread::is_managed_thread()) {
+        l.unlock();
+
+        vthread::suspend([this](std::shared_ptr<vthread> self) {
+          std::unique_lock<std::mutex> l(lock);
+
+          if (complete)
+            return false;
+
+          joiners.push_back(self);
+
+          return true;
+        });
+
+        l.lock();
+      } else
+        vthread::wait(cond, l);
+    }
+  }
+
+  void then(std::function<void(void)> func) {
+    std::unique_lock<std::mutex> l(lock);
+
+    if (!complete) {
+      continuations.push_back(std::move(func));
+      return;
+    }
+
+    l.unlock();
+
+    func();
+  }
+};
+
+} // namespace parallel_f
@@ -3,9 +3,12 @@
 
 #pragma once
 
+#include <atomic>
 #include <iostream>
 #include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 
 #ifdef _WIN32
 #include <profileapi.h>
@@ -14,6 +17,7 @@
 #include <sys/time.h>
 #endif
 
+#include "budget.hpp"
 #include "system.hpp"
 
 
@@ -82,6 +86,99 @@ public:
 };
 
 
+class wait_stat
+{
+private:
+	std::string name;
+	std::mutex lock;
+	double seconds_total;
+	float seconds_max;
+	unsigned int num;
+
+public:
+	wait_stat(std::string name) : name(name)
+	{
+		reset();
+	}
+
+	/* may be called concurrently, callers should report in batches */
+	void report_wait(double seconds_total, float seconds_max, unsigned int num)
+	{
+		std::unique_lock<std::mutex> l(lock);
+
+		this->seconds_total += seconds_total;
+
+		if (this->seconds_max < seconds_max)
+			this->seconds_max = seconds_max;
+
+		this->num += num;
+	}
+
+	std::string get_name() const
+	{
+		return name;
+	}
+
+	void show_and_reset()
+	{
+		std::unique_lock<std::mutex> l(lock);
+
+		if (num)
+			system::instance().log("Wait '%s': %.3f ms average, %.3f ms max (%u vthreads)\n",
+								   name.c_str(), seconds_total / num * 1000.0, seconds_max * 1000.0f, num);
+
+		seconds_total = 0.0;
+		seconds_max = 0.0f;
+		num = 0;
+	}
+
+	void reset()
+	{
+		std::unique_lock<std::mutex> l(lock);
+
+		seconds_total = 0.0;
+		seconds_max = 0.0f;
+		num = 0;
+	}
+};
+
+
+class counter
+{
+private:
+	std::string name;
+	std::atomic<unsigned int> num;
+
+public:
+	counter(std::string name) : name(name), num(0)
+	{
+	}
+
+	void add(unsigned int n = 1)
+	{
+		num.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	std::string get_name() const
+	{
+		return name;
+	}
+
+	unsigned int get() const
+	{
+		return num.load(std::memory_order_relaxed);
+	}
+
+	void show_and_reset()
+	{
+		unsigned int n = num.exchange(0);
+
+		if (n)
+			system::instance().log("Count '%s': %u\n", name.c_str(), n);
+	}
+};
+
+
 class instance
 {
 public:
@@ -95,6 +192,8 @@ public:
 private:
 	std::mutex lock;
 	std::list<std::shared_ptr<stat>> stats;
+	std::list<std::shared_ptr<wait_stat>> waits;
+	std::list<std::shared_ptr<counter>> counters;
 	sysclock total;
 
 private:
@@ -114,6 +213,43 @@ public:
 		return s;
 	}
 
+	std::shared_ptr<wait_stat> make_wait_stat(std::string name)
+	{
+		std::unique_lock<std::mutex> l(lock);
+
+		auto s = std::make_shared<wait_stat>(name);
+
+		waits.push_back(s);
+
+		return s;
+	}
+
+	std::shared_ptr<counter> make_counter(std::string name)
+	{
+		std::unique_lock<std::mutex> l(lock);
+
+		auto c = std::make_shared<counter>(name);
+
+		counters.push_back(c);
+
+		return c;
+	}
+
+	/* sum of the counters named 'name' since they were last shown */
+	unsigned int get_count(std::string name)
+	{
+		std::unique_lock<std::mutex> l(lock);
+
+		unsigned int n = 0;
+
+		for (auto c : counters) {
+			if (c->get_name() == name)
+				n += c->get();
+		}
+
+		return n;
+	}
+
 	void show_stats()
 	{
 		std::unique_lock<std::mutex> l(lock);
@@ -148,6 +284,21 @@ public:
 								   g.first.c_str(), total_load, total_num, (total_busy / total_seconds) * 100.0f,
 								   total_seconds);
 		}
+
+		for (auto w : waits)
+			w->show_and_reset();
+
+		for (auto c : counters)
+			c->show_and_reset();
+
+		int peak;
+		unsigned int over;
+
+		budget::instance().take_stats(peak, over);
+
+		if (peak)
+			system::instance().log("Budget: %d of %d CPUs in use, %d peak, %u oversubscribed\n",
+					       budget::instance().in_use(), budget::instance().capacity(), peak, over);
 	}
 };
 
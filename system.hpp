@@ -16,6 +16,8 @@
 #include <stdarg.h>
 #include <string.h>
 
+#include "budget.hpp"
+
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -151,8 +153,8 @@ public:
 
   int get_debug_level() { return debug_level; }
 
-  int get_debug_level(std::string str) {
-    for (auto it : debug_levels) {
+  int get_debug_level(const std::string &str) {
+    for (auto &it : debug_levels) {
       if (str.find(it.first) != str.npos)
         return it.second;
     }
@@ -162,6 +164,9 @@ public:
 
   void set_debug_level(int level) { debug_level = level; }
 
+  /* false if no debug message can pass, checked before formatting any */
+  bool debug_active() { return debug_level != 0 || !debug_levels.empty(); }
+
   void set_debug_level(std::string str, int level) {
     debug_levels[str] = level;
   }
@@ -213,6 +218,8 @@ private:
 public:
   void start_flush_thread(unsigned int ms) {
     if (!flush_thread) {
+      budget::instance().acquire();
+
       flush_thread = std::make_unique<std::thread>([this, ms]() {
         while (!flush_thread_stop) {
           std::this_thread::sleep_for(std::chrono::milliseconds(ms));
@@ -232,6 +239,8 @@ public:
       flush_thread->join();
 
       flush_thread.reset();
+
+      budget::instance().release();
     }
   }
 };
@@ -240,10 +249,14 @@ static inline int get_debug_level() {
   return system::instance().get_debug_level();
 }
 
-static inline int get_debug_level(std::string str) {
+static inline int get_debug_level(const std::string &str) {
   return system::instance().get_debug_level(str);
 }
 
+static inline bool debug_active() {
+  return system::instance().debug_active();
+}
+
 static inline void set_debug_level(int level) {
   system::instance().set_debug_level(level);
 }
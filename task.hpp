@@ -3,11 +3,14 @@
 
 #pragma once
 
+#include <memory>
+#include <optional>
 #include <tuple>
 
+#include "future_value.hpp"
+#include "hedge.hpp"
 #include "log.hpp"
-
-#include "task_info.hpp"
+#include "vthread.hpp"
 
 namespace parallel_f {
 
@@ -22,33 +25,48 @@ namespace core {
  * arguments. The task stores the callable and its arguments internally and
  * can execute the callable with the stored arguments.
  *
- * The task also inherits from the task_info class which stores information
- * about the task, such as its callable and arguments.
+ * The task also inherits from task_result, storing what the callable returns
+ * for result() to hand out as a typed future_value.
+ *
+ * A hedged task (with copyable callable and arguments) running on an executor
+ * is raced against a copy started on an idle worker, once it takes longer than
+ * usual for its callable type (see hedging). The first result is published and
+ * finishes the task, the other one is discarded.
  *
  * Inheritance:
- *   public task_info
+ *   public task_result<stored_result_t<std::invoke_result_t<Callable, Args...>>>
  *
  * Attributes:
  *   private:
  *     Callable callable: the callable object stored internally
- *     std::tuple<Args...> args: the arguments stored internally
+ *     std::tuple<Args...> args: the arguments stored internally, both are
+ *       released when the task is cancelled and moved into the call when
+ *       it is run, so they may be move-only
  *
  * Methods:
  *   public:
- *     task(Callable callable, Args&&... args): initializes the task with
- *       the callable and arguments
+ *     task(std::in_place_t, C&& callable, A&&... args): initializes the task
+ *       with the callable and arguments, forwarding them into storage
  *     virtual ~task(): destructor
  *   protected:
  *     virtual bool run(): executes the callable with the stored arguments
+ *     bool run_hedged(): like run, starting a copy if needed
+ *     virtual void drop(): releases the callable, arguments and result
  */
-template <typename Callable, typename... Args> class task : public task_info {
+template <typename Callable, typename... Args>
+class task
+    : public task_result<stored_result_t<std::invoke_result_t<Callable, Args...>>> {
 private:
-  Callable callable;
-  std::tuple<Args...> args;
+  typedef stored_result_t<std::invoke_result_t<Callable, Args...>> result_type;
+
+  std::optional<Callable> callable;
+  std::optional<std::tuple<Args...>> args;
 
 public:
-  task(Callable callable, Args &&...args)
-      : task_info(callable, args...), callable(callable), args(args...) {
+  template <typename C, typename... A>
+  task(std::in_place_t, C &&c, A &&...a)
+      : task_result<result_type>(c, a...), callable(std::forward<C>(c)),
+        args(std::in_place, std::forward<A>(a)...) {
     LOG_DEBUG("task::task()\n");
   }
 
@@ -58,15 +76,154 @@ protected:
   virtual bool run() {
     LOG_DEBUG("task::run()...\n");
 
-    if constexpr (std::is_void_v<std::invoke_result_t<Callable, Args...>>)
-      std::apply(callable, args);
+    if constexpr (copyable) {
+      if (this->is_hedged() && executor::current_executor())
+        return run_hedged();
+    }
+
+    /* run once, the stored arguments are moved into the call */
+    if constexpr (std::is_void_v<result_type>)
+      std::apply(std::move(*callable), std::move(*args));
     else
-      value = std::apply(callable, args);
+      this->value = std::apply(std::move(*callable), std::move(*args));
 
     LOG_DEBUG("task::run() done.\n");
 
     return true;
   }
+
+  virtual void drop() {
+    callable.reset();
+    args.reset();
+
+    task_result<result_type>::drop();
+  }
+
+private:
+  static constexpr bool copyable =
+      std::is_copy_constructible_v<Callable> &&
+      (std::is_copy_constructible_v<Args> && ...);
+
+  /* never destroyed, running tasks may still report while exiting */
+  static details::hedge_history &history() {
+    static details::hedge_history *history_instance =
+        new details::hedge_history();
+
+    return *history_instance;
+  }
+
+  /* what a duplicate run needs, only held by the timer entry until started */
+  class hedge_copy {
+  public:
+    std::shared_ptr<task> self;
+    Callable c;
+    std::tuple<Args...> a;
+
+    hedge_copy(std::shared_ptr<task> self, const Callable &c,
+               const std::tuple<Args...> &a)
+        : self(std::move(self)), c(c), a(a) {}
+  };
+
+  bool run_hedged() {
+    auto race = std::make_shared<std::atomic<bool>>(false);
+    int64_t start = details::hedge_timer::clock_ns();
+    int64_t threshold = history().threshold();
+
+    /* dropped as soon as we return, so the timer entry does not keep the task,
+     * callable and arguments until it is due */
+    std::shared_ptr<hedge_copy> copy;
+
+    if (threshold) {
+      executor *exec = executor::current_executor();
+      priority prio = this->get_priority();
+
+      /* copied up front, the original may modify its own */
+      copy = std::make_shared<hedge_copy>(
+          std::static_pointer_cast<task>(this->shared_from_this()), *callable,
+          *args);
+
+      details::hedge_timer::instance().add(
+          start + threshold,
+          [race, weak = std::weak_ptr<hedge_copy>(copy), exec, prio,
+           threshold](int64_t now) -> int64_t {
+            auto copy = weak.lock();
+
+            if (!copy || *race)
+              return 0;
+
+            /* no idle worker, look again later */
+            if (!exec->parked())
+              return now + std::max<int64_t>(threshold / 4, 100000);
+
+            details::hedge_timer::started->add();
+
+            auto t = std::make_shared<vthread>("hedge", exec);
+
+            t->set_priority(prio);
+            t->start([race, copy = std::move(copy)]() {
+              copy->self->run_copy(race, copy->c, copy->a);
+            });
+
+            return 0;
+          });
+    }
+
+    if constexpr (std::is_void_v<result_type>) {
+      std::apply(std::move(*callable), std::move(*args));
+
+      copy.reset();
+
+      history().report(details::hedge_timer::clock_ns() - start);
+
+      /* the copy won and finishes the task */
+      if (race->exchange(true))
+        return false;
+    } else {
+      auto r = std::apply(std::move(*callable), std::move(*args));
+
+      copy.reset();
+
+      history().report(details::hedge_timer::clock_ns() - start);
+
+      if (race->exchange(true))
+        return false;
+
+      this->value = std::move(r);
+    }
+
+    LOG_DEBUG("task::run_hedged() done.\n");
+
+    return true;
+  }
+
+  void run_copy(std::shared_ptr<std::atomic<bool>> race, Callable &c,
+                std::tuple<Args...> &a) {
+    LOG_DEBUG("task::run_copy()...\n");
+
+    int64_t start = details::hedge_timer::clock_ns();
+
+    if constexpr (std::is_void_v<result_type>) {
+      std::apply(std::move(c), std::move(a));
+
+      history().report(details::hedge_timer::clock_ns() - start);
+
+      if (race->exchange(true))
+        return;
+    } else {
+      auto r = std::apply(std::move(c), std::move(a));
+
+      history().report(details::hedge_timer::clock_ns() - start);
+
+      if (race->exchange(true))
+        return;
+
+      this->value = std::move(r);
+    }
+
+    details::hedge_timer::won->add();
+
+    this->enter_state(task_base::task_state::FINISHED);
+  }
 };
 
 } // namespace core
@@ -3,11 +3,17 @@
 
 #pragma once
 
-#include <mutex>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
 
+#include "affinity.hpp"
+#include "cancel.hpp"
+#include "completion.hpp"
 #include "log.hpp"
-
-#include "Event.hxx"
+#include "priority.hpp"
+#include "slab_pool.hpp"
+#include "unique_function.hpp"
 
 namespace parallel_f {
 namespace core {
@@ -37,51 +43,167 @@ namespace core {
  *  FINISHED state, and is used internally by the finish function to
  *  transition from the CREATED state to the RUNNING state.
  *
- *  The `finished` event is dispatched when the task enters the FINISHED
- *  state, and is used by the caller of `finish` to wait for the task to
- *  complete, or to perform some action after the task has completed.
+ *  The state is atomic and the task has no lock, entering FINISHED completes
+ *  the task's `completion`, which calls everything registered for it without
+ *  holding a lock, see completion.
+ *
+ *  An `observer` is linked into the task by `attach`, e.g. the task_node
+ *  running the task or someone waiting for it, and called when the task
+ *  enters the FINISHED state, right away if it has already. It costs no
+ *  allocation.
+ *
+ *  The `on_finished` function registers a one-shot continuation without an
+ *  observer object, called in the same way.
+ *
+ *  The `priority` selects the scheduling class of the vthread running the
+ *  task when it is executed by a task_queue or task_list.
+ *
+ *  The `cancel` function skips a task which has not been started yet. It
+ *  drops the task's payload (see `drop`) and enters the FINISHED state with
+ *  `is_cancelled` returning true. Tasks executed by a task_queue or task_list
+ *  are cancelled this way when their `cancel_token` is.
+ *
+ *  The `cost` is an optional estimate in bytes of what the task holds while
+ *  in flight, counted against the window of a task_queue or task_list.
+ *
+ *  A `hedged` task may be run twice, see task, so it has to be idempotent.
+ *
+ *  The `affinity` names the data the task works on, tasks with the same key
+ *  preferably run on the same worker.
  */
 class task_base {
 public:
   enum class task_state { CREATED, RUNNING, FINISHED };
 
-  parallel_f::events::event<int> finished;
+  typedef completion::waiter observer;
 
 private:
-  task_state state;
-  std::mutex mutex;
+  std::atomic<task_state> state;
+  bool cancelled;
+  size_t cost;
+  bool hedged;
+  parallel_f::affinity affine;
+  parallel_f::priority prio;
+  parallel_f::cancel_token token;
+  completion done;
+
+  /* on_finished() function, owning itself while linked, from the slab pool */
+  class continuation final : public observer {
+  private:
+    unique_function<void(void)> func;
+
+    class deleter {
+    public:
+      void operator()(continuation *c) const {
+        c->~continuation();
+
+        slab_pool::get().deallocate(c, sizeof(continuation),
+                                    alignof(continuation));
+      }
+    };
+
+    continuation(unique_function<void(void)> func) : func(std::move(func)) {}
+
+  public:
+    static continuation *make(unique_function<void(void)> func) {
+      void *p = slab_pool::get().allocate(sizeof(continuation),
+                                          alignof(continuation));
+
+      return new (p) continuation(std::move(func));
+    }
+
+    void completed() {
+      std::unique_ptr<continuation, deleter> self(this);
+
+      func();
+    }
+
+    void discarded() { deleter()(this); }
+  };
 
 public:
-  task_base() : state(task_state::CREATED) {
+  task_base()
+      : state(task_state::CREATED), cancelled(false), cost(0),
+        hedged(false), prio(parallel_f::priority::normal) {
     LOG_DEBUG("task_base::task_base(%p)\n", this);
   }
 
   ~task_base() { LOG_DEBUG("task_base::~task_base(%p)\n", this); }
 
-  task_state get_state() const { return state; }
+  task_state get_state() const {
+    return state.load(std::memory_order_acquire);
+  }
+
+  parallel_f::priority get_priority() const { return prio; }
 
-  bool finish() {
-    LOG_DEBUG("task_base::finish(%p)\n", this);
+  void set_priority(parallel_f::priority p) { prio = p; }
 
-    std::unique_lock<std::mutex> lock(mutex);
+  bool is_cancelled() const { return cancelled; }
 
-    switch (state) {
-    case task_state::CREATED:
-      state = task_state::RUNNING;
+  size_t get_cost() const { return cost; }
+
+  void set_cost(size_t bytes) { cost = bytes; }
+
+  bool is_hedged() const { return hedged; }
+
+  void set_hedged(bool h) { hedged = h; }
+
+  parallel_f::affinity get_affinity() const { return affine; }
+
+  void set_affinity(parallel_f::affinity a) { affine = a; }
+
+  parallel_f::cancel_token get_cancel_token() const { return token; }
+
+  void set_cancel_token(parallel_f::cancel_token t) { token = t; }
+
+  /* skip the task if it has not been started after 'timeout' from now, or if
+   * the current token (if any) gets cancelled */
+  void set_timeout(std::chrono::steady_clock::duration timeout) {
+    token = token.with_timeout(timeout);
+  }
+
+  /* returns false if the task has been started already */
+  bool cancel() {
+    LOG_DEBUG("task_base::cancel(%p)\n", this);
+
+    if (!start())
+      return false;
+
+    cancelled = true;
 
-      lock.unlock();
+    drop();
 
+    enter_state(task_state::FINISHED);
+
+    return true;
+  }
+
+  void on_finished(unique_function<void(void)> func) {
+    if (done.is_complete()) {
+      func();
+      return;
+    }
+
+    done.attach(continuation::make(std::move(func)));
+  }
+
+  /* links 'o' to be called when finished, calls it right away if already */
+  void attach(observer *o) { done.attach(o); }
+
+  /* waits for a running call of 'o' to return, unless called from a callback
+   * of this task, which just skips 'o' if it is still to be called */
+  void detach(observer *o) { done.detach(o); }
+
+  bool finish() {
+    LOG_DEBUG("task_base::finish(%p)\n", this);
+
+    if (start()) {
       if (run()) {
         enter_state(task_state::FINISHED);
         LOG_DEBUG("task_base::finish(%p) returning true\n", this);
         return true;
       }
-      break;
-
-    case task_state::RUNNING:
-      return false;
-
-    case task_state::FINISHED:
+    } else if (get_state() == task_state::FINISHED) {
       LOG_DEBUG("task_base::finish(%p) returning true\n", this);
       return true;
     }
@@ -91,31 +213,45 @@ public:
     return false;
   }
 
+private:
+  /* CREATED -> RUNNING, false if another call got there first */
+  bool start() {
+    task_state expected = task_state::CREATED;
+
+    return state.compare_exchange_strong(expected, task_state::RUNNING,
+                                         std::memory_order_acq_rel);
+  }
+
 protected:
   void enter_state(task_state state) {
     LOG_DEBUG("task_base::enter_state(%p, %d)\n", this, (int)state);
 
-    std::unique_lock<std::mutex> lock(mutex);
+    switch (state) {
+    case task_state::FINISHED: {
+      task_state current = task_state::RUNNING;
 
-    if (this->state == state)
-      return;
+      /* before notifying anyone, so successors see it finished */
+      if (!this->state.compare_exchange_strong(current, state,
+                                               std::memory_order_acq_rel)) {
+        if (current == state)
+          return;
 
-    switch (state) {
-    case task_state::FINISHED:
-      if (this->state != task_state::RUNNING)
         throw std::runtime_error("not running");
+      }
 
-      finished.dispatch(0);
+      done.complete();
       break;
+    }
 
     default:
       throw std::runtime_error("invalid transition");
     }
-
-    this->state = state;
   }
 
   virtual bool run() = 0;
+
+  /* releases everything held for running the task or as its result */
+  virtual void drop() {}
 };
 
 } // namespace core
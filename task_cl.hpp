@@ -63,10 +63,16 @@ public:
     spawn_queue_thread();
   }
 
+  /* the first queue thread is needed in any case, further ones only within the CPU budget */
   void spawn_queue_thread() {
     if (threads.size() >= std::thread::hardware_concurrency())
       return;
 
+    if (threads.empty())
+      parallel_f::budget::instance().acquire();
+    else if (!parallel_f::budget::instance().try_acquire())
+      return;
+
     auto stat = parallel_f::stats::instance::get().make_stat(
         std::string("cl.") + std::to_string(threads.size()));
 
@@ -116,6 +122,8 @@ public:
       t->join();
 
       delete t;
+
+      parallel_f::budget::instance().release();
     }
 
     delete ocl_device;
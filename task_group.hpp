@@ -0,0 +1,233 @@
+// === (C) 2020-2024 === parallel_f / task_group (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "job.hpp"
+#include "log.hpp"
+#include "vthread.hpp"
+
+namespace parallel_f {
+
+// parallel_f :: task_group == implementation
+
+/*
+ * Fork-join within a running task, e.g. for recursive divide and conquer
+ *
+ *     parallel_f::task_group g;
+ *
+ *     g.spawn([&]() { sort(begin, mid); });
+ *     g.spawn([&]() { sort(mid, end); });
+ *
+ *     g.wait();
+ *
+ * Called from a task, spawn() pushes a job onto the worker's own deque, where
+ * idle workers may steal it, while wait() runs the group's jobs (latest first)
+ * and others it can take, suspending the task only once there is nothing left
+ * to help with. Jobs are allocated in blocks reused after wait() and small
+ * callables are stored in place, so a spawn does not allocate. Outside of
+ * managed threads each job gets its own vthread on the group's executor.
+ *
+ * spawn() and wait() are to be called by one thread (or task) at a time, the
+ * jobs may use groups of their own. The first exception thrown by a job is
+ * rethrown by wait(). The destructor waits as well.
+ */
+class task_group {
+private:
+  static const size_t inline_size = 48;
+  static const size_t block_size = 64;
+
+  class item : public details::job {
+  public:
+    task_group *group;
+    alignas(std::max_align_t) unsigned char storage[inline_size];
+  };
+
+  executor *exec;
+  priority prio;
+  std::atomic<int> pending;
+  std::vector<std::unique_ptr<item[]>> blocks;
+  size_t used;
+  std::mutex lock;
+  std::condition_variable cond;
+  std::shared_ptr<vthread> waiter;
+  std::exception_ptr error;
+
+public:
+  /* 'exec' runs jobs spawned outside of managed threads, nullptr for the
+   * default executor */
+  task_group(executor *exec = nullptr)
+      : exec(exec), prio(priority::normal), pending(0), used(0) {
+    vthread *t = executor::current_vthread();
+
+    /* children inherit the priority of the spawning task */
+    if (t)
+      prio = t->get_priority();
+  }
+
+  ~task_group() {
+    try {
+      wait();
+    } catch (...) {
+      LOG_ERROR("task_group::~task_group(): job failed\n");
+    }
+  }
+
+  task_group(const task_group &) = delete;
+  task_group &operator=(const task_group &) = delete;
+
+  template <typename Callable> void spawn(Callable &&callable) {
+    typedef std::decay_t<Callable> F;
+
+    item *i = allocate();
+
+    i->group = this;
+    i->prio = prio;
+    i->func = invoke<F>;
+
+    if constexpr (stored_inline<F>())
+      new (i->storage) F(std::forward<Callable>(callable));
+    else
+      new (i->storage) F *(new F(std::forward<Callable>(callable)));
+
+    pending.fetch_add(1, std::memory_order_relaxed);
+
+    if (!executor::push_job(i))
+      (exec ? *exec : executor::instance()).start_job(i);
+  }
+
+  void wait() {
+    for (;;) {
+      /* work first, help with our jobs (or any others) */
+      while (pending.load(std::memory_order_acquire)) {
+        details::job *j = executor::take_job();
+
+        if (!j)
+          break;
+
+        j->run();
+      }
+
+      /* the last job finishes with the lock held, see done() */
+      std::unique_lock<std::mutex> l(lock);
+
+      if (!pending.load(std::memory_order_acquire))
+        break;
+
+      if (vthread::is_managed_thread()) {
+        l.unlock();
+
+        vthread::suspend([this](std::shared_ptr<vthread> self) {
+          std::unique_lock<std::mutex> l(lock);
+
+          if (!pending.load(std::memory_order_acquire))
+            return false;
+
+          waiter = self;
+
+          return true;
+        });
+      } else {
+        while (pending.load(std::memory_order_acquire))
+          vthread::wait(cond, l);
+      }
+    }
+
+    used = 0;
+
+    if (error) {
+      std::exception_ptr e = error;
+
+      error = nullptr;
+
+      std::rethrow_exception(e);
+    }
+  }
+
+private:
+  template <typename F> static constexpr bool stored_inline() {
+    return sizeof(F) <= inline_size &&
+           alignof(F) <= alignof(std::max_align_t);
+  }
+
+  item *allocate() {
+    if (used == blocks.size() * block_size)
+      blocks.emplace_back(new item[block_size]);
+
+    item *i = &blocks[used / block_size][used % block_size];
+
+    used++;
+
+    return i;
+  }
+
+  template <typename F> static void invoke(details::job *j) {
+    item *i = static_cast<item *>(j);
+    task_group *g = i->group;
+    F *f;
+
+    if constexpr (stored_inline<F>())
+      f = std::launder(reinterpret_cast<F *>(i->storage));
+    else
+      f = *std::launder(reinterpret_cast<F **>(i->storage));
+
+    try {
+      (*f)();
+    } catch (...) {
+      g->fail(std::current_exception());
+    }
+
+    if constexpr (stored_inline<F>())
+      f->~F();
+    else
+      delete f;
+
+    g->done();
+  }
+
+  void fail(std::exception_ptr e) {
+    std::unique_lock<std::mutex> l(lock);
+
+    if (!error)
+      error = e;
+  }
+
+  void done() {
+    int p = pending.load(std::memory_order_relaxed);
+
+    /* not the last one, the group is still waited for */
+    while (p > 1) {
+      if (pending.compare_exchange_weak(p, p - 1, std::memory_order_acq_rel,
+                                        std::memory_order_relaxed))
+        return;
+    }
+
+    std::unique_lock<std::mutex> l(lock);
+
+    if (pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+      return;
+
+    std::shared_ptr<vthread> w = std::move(waiter);
+
+    cond.notify_all();
+
+    /* the group may be gone once the lock is released */
+    l.unlock();
+
+    if (w)
+      vthread::resume(w);
+  }
+};
+
+} // namespace parallel_f
@@ -16,6 +16,11 @@ namespace core {
 
 // parallel_f :: task_info == implementation
 
+/*
+ * Untyped access to task results. Tasks keep their result typed (see
+ * task_result and future_value), Value is kept for callables taking one,
+ * its get<T>() copies the result via a std::any.
+ */
 class task_info : public task_base,
                   public std::enable_shared_from_this<task_info> {
 public:
@@ -28,17 +33,22 @@ public:
   public:
     Value(std::shared_ptr<task_info> task) : task(task) {}
 
-    template <typename _T> _T get() { return std::any_cast<_T>(task->value); }
-  };
+    template <typename _T> _T get() const {
+      return std::any_cast<_T>(task->get_any());
+    }
 
-protected:
-  std::any value;
+    std::shared_ptr<task_info> get_task() const { return task; }
+  };
 
 protected:
   task_info() {}
 
+  /* only looks at the arguments with debug output on, without copying them */
   template <typename Callable, typename... Args>
-  task_info(Callable callable, Args... args) {
+  task_info(const Callable &callable, const Args &...args) {
+    if (!debug_active())
+      return;
+
     if (sizeof...(args)) {
       LOG_DEBUG("task_info::task_info(): [[%s]], showing %zu arguments...\n",
                 typeid(Callable).name(), sizeof...(args));
@@ -53,15 +63,23 @@ protected:
 public:
   Value result() { return Value(this->shared_from_this()); }
 
+protected:
+  /* a copy of the result, empty if there is none (yet) */
+  virtual std::any get_any() { return std::any(); }
+
+  virtual void drop() {}
+
 private:
-  template <typename ArgType> void DumpArg(ArgType arg) {
+  template <typename ArgType> void DumpArg(const ArgType &arg) {
     LOG_DEBUG("task_info::task_info():   Type: %s\n", typeid(ArgType).name());
   }
 };
 
-template <> inline std::any task_info::Value::get() { return task->value; }
+template <> inline std::any task_info::Value::get() const {
+  return task->get_any();
+}
 
-template <> inline void task_info::DumpArg(Value arg) {
+template <> inline void task_info::DumpArg(const Value &arg) {
   switch (parallel_f::get_debug_level()) {
   case 2:
     arg.task->finish();
@@ -4,19 +4,20 @@
 #pragma once
 
 #include <any>
+#include <atomic>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
 #include <queue>
 #include <tuple>
 
 #include "log.hpp"
+#include "slab_pool.hpp"
 #include "stats.hpp"
 #include "system.hpp"
 #include "vthread.hpp"
 
-#include "Event.hxx"
-
 #include "joinable.hpp"
 #include "task.hpp"
 
@@ -24,62 +25,174 @@ namespace parallel_f {
 
 namespace details {
 
-class task_node : public parallel_f::events::event_listener {
+/*
+ * Runs a task once its wait count drops to zero.
+ *
+ * The node is the vthread running the task and observes the task directly,
+ * so a task costs the task itself plus one cache line aligned allocation for
+ * node and vthread. The wait count is atomic, only the notify() dropping it to
+ * zero takes the lock. Lock, condition and joiners are the vthread's, callbacks
+ * go to the task.
+ *
+ * TODO: a compact node of one cache line, intrusively counted, would have to
+ * run its task as a job instead of being a vthread (some 500 bytes with lock,
+ * condition, joiners and entry point), with priority, deadline, affinity and
+ * preemption moving to jobs, and queues, joinables and task_list holding nodes
+ * by the intrusive count instead of shared_ptr.
+ */
+class alignas(64) task_node : public vthread,
+                              public task_base::observer,
+                              public cancel_target {
 private:
   std::shared_ptr<task_base> task;
-  unsigned int wait;
+  std::atomic<unsigned int> wait;
   bool managed;
-  std::shared_ptr<vthread> thread;
-  std::mutex lock;
-  std::condition_variable cond;
   bool finished;
+  bool cancelled;
+  bool held;
+  std::shared_ptr<task_node> next; // first successor, e.g. in a task_queue
+  std::pmr::vector<std::shared_ptr<task_node>> more; // further successors
+  std::shared_ptr<task_node> running; // until completed(), see run_task()
 
 public:
-  task_node(std::string name, std::shared_ptr<task_base> task,
-            unsigned int wait, bool managed = true)
-      : task(task), wait(wait), managed(managed), finished(false) {
-    LOG_DEBUG("task_node::task_node(%p, '%s', %u)\n", this, name.c_str(), wait);
+  /* 'exec' is the executor to run the task on, nullptr for the default one,
+   * 'name' has to be static, see vthread, successors beyond the first one are
+   * kept in memory from 'resource' */
+  task_node(const char *name, std::shared_ptr<task_base> task,
+            unsigned int wait, executor *exec = nullptr, bool managed = true,
+            std::pmr::memory_resource *resource = &slab_pool::get())
+      : vthread(name, exec), task(std::move(task)), wait(wait),
+        managed(managed), finished(false), cancelled(false), held(true),
+        more(resource) {
+    LOG_DEBUG("task_node::task_node(%p, '%s', %u)\n", this,
+              get_name().c_str(), wait);
+
+    this->task->attach(this);
+  }
 
-    thread = std::make_shared<vthread>(name);
+  /* creates a node skipped when the task's cancel_token gets cancelled */
+  static std::shared_ptr<task_node> make(const char *name,
+                                         std::shared_ptr<task_base> task,
+                                         unsigned int wait,
+                                         executor *exec = nullptr,
+                                         bool managed = true) {
+    return make(&slab_pool::get(), name, std::move(task), wait, exec,
+                managed);
+  }
 
-    task->finished.attach(this, [this](int) {
-      std::unique_lock<std::mutex> l(lock);
+  /* like above, allocating the node from 'resource' */
+  static std::shared_ptr<task_node>
+  make(std::pmr::memory_resource *resource, const char *name,
+       std::shared_ptr<task_base> task, unsigned int wait,
+       executor *exec = nullptr, bool managed = true) {
+    auto node = std::allocate_shared<task_node>(
+        std::pmr::polymorphic_allocator<task_node>(resource), name,
+        std::move(task), wait, exec, managed, resource);
 
-      finished = true;
+    node->task->get_cancel_token().attach(node);
 
-      cond.notify_all();
-    });
+    return node;
   }
 
   ~task_node() {
     LOG_DEBUG("task_node::~task_node(%p '%s')\n", this, get_name().c_str());
+
+    /* the task won't call a finished node again */
+    if (!finished)
+      task->detach(this);
   }
 
   void add_to_notify(std::shared_ptr<task_node> node) {
     LOG_DEBUG("task_node::add_to_notify(%p '%s', %p)\n", this,
               get_name().c_str(), node.get());
 
-    if (finished)
-      throw std::runtime_error("finished");
+    std::unique_lock<std::mutex> l(mutex);
+
+    /* e.g. started early by a window or cancelled, finished but not yet
+     * dropped by the task_list */
+    if (finished) {
+      l.unlock();
+
+      node->notify();
+      return;
+    }
+
+    if (!next)
+      next = std::move(node);
+    else
+      more.push_back(std::move(node));
+  }
+
+  /* the first successor as long as the task is not finished, e.g. the next
+   * node of a task_queue */
+  std::shared_ptr<task_node> get_next() {
+    std::unique_lock<std::mutex> l(mutex);
+
+    return next;
+  }
+
+  /* notify() for the creator's own count in 'wait', has no effect after the
+   * first call, e.g. for nodes started early by a task_list window */
+  void release() {
+    {
+      std::unique_lock<std::mutex> l(mutex);
+
+      if (!held)
+        return;
+
+      held = false;
+    }
+
+    notify();
+  }
+
+  /* has no effect once the task has been started */
+  void set_deadline(std::chrono::steady_clock::time_point deadline) {
+    std::unique_lock<std::mutex> l(mutex);
 
-    task->finished.attach(node.get(), [node](int) { node->notify(); });
+    if (wait.load(std::memory_order_relaxed))
+      vthread::set_deadline(deadline);
   }
 
   void notify() {
     LOG_DEBUG("task_node::notify(%p '%s')...\n", this, get_name().c_str());
 
-    std::unique_lock<std::mutex> l(lock);
+    unsigned int count = wait.fetch_sub(1, std::memory_order_acq_rel);
 
     LOG_DEBUG("task_node::notify(%p '%s') wait count %u -> %u\n", this,
-              get_name().c_str(), wait, wait - 1);
+              get_name().c_str(), count, count - 1);
 
-    if (!wait)
+    if (!count)
       throw std::runtime_error("zero wait count");
 
-    if (!--wait) {
-      std::shared_ptr<task_base> t = task;
+    if (count == 1) {
+      std::unique_lock<std::mutex> l(mutex);
+
+      if (cancelled || finished)
+        return;
+
+      auto token = task->get_cancel_token();
+
+      /* timeouts are noticed here */
+      if (token.is_cancelled()) {
+        cancelled = true;
+
+        l.unlock();
+
+        task->cancel();
+        return;
+      }
 
-      thread->start([t]() { bool finished = t->finish(); }, managed);
+      auto self = std::static_pointer_cast<task_node>(shared_from_this());
+
+      set_priority(task->get_priority());
+      set_affinity(task->get_affinity());
+      set_cancel_token(std::move(token));
+
+      l.unlock();
+
+      /* keeps the node alive until the task is finished */
+      start([self = std::move(self)]() { self->run_task(); }, managed);
     }
 
     LOG_DEBUG("task_node::notify(%p '%s') done.\n", this, get_name().c_str());
@@ -88,21 +201,137 @@ public:
   void join() {
     LOG_DEBUG("task_node::join(%p '%s')...\n", this, get_name().c_str());
 
-    std::unique_lock<std::mutex> l(lock);
+    std::unique_lock<std::mutex> l(mutex);
 
     while (!finished) {
       LOG_DEBUG("task_node::join(%p '%s') waiting...\n", this,
                 get_name().c_str());
 
-      vthread::wait(cond, l);
+      if (vthread::is_managed_thread()) {
+        l.unlock();
+
+        vthread::suspend([this](std::shared_ptr<vthread> self) {
+          std::unique_lock<std::mutex> l(mutex);
+
+          if (finished)
+            return false;
+
+          joiners.push_back(self);
+
+          return true;
+        });
+
+        l.lock();
+      } else
+        vthread::wait(cond, l);
     }
 
     LOG_DEBUG("task_node::join(%p '%s') done.\n", this, get_name().c_str());
   }
 
-  std::thread::id get_thread_id() { return thread->get_id(); }
+  /* calls 'func' when the task is finished, right away if it is already,
+   * after the node has notified its successors and joiners */
+  void on_finished(unique_function<void(void)> func) {
+    task->on_finished(std::move(func));
+  }
+
+  std::thread::id get_thread_id() { return get_id(); }
+
+  /* cancel_target */
+  void mark_cancelled() {
+    std::unique_lock<std::mutex> l(mutex);
+
+    if (wait.load(std::memory_order_relaxed))
+      cancelled = true;
+  }
+
+  void cancel_now() {
+    std::unique_lock<std::mutex> l(mutex);
+
+    if (!cancelled || finished)
+      return;
+
+    l.unlock();
+
+    /* finishes the node, notifying successors and joiners */
+    task->cancel();
+  }
+
+private:
+  void run_task() {
+    /* cancelled or timed out while queued, which mark_cancelled() leaves to
+     * us, cancel() fails if someone else started the task meanwhile */
+    if (get_cancel_token().is_cancelled() && task->cancel())
+      return;
+
+    /* tasks may finish asynchronously (returning false from run), e.g. a
+     * co_task suspended in co_await, the node stays alive until completed()
+     * while its vthread exits right away */
+    {
+      std::unique_lock<std::mutex> l(mutex);
+
+      /* e.g. a co_task started and finished elsewhere already */
+      if (finished)
+        return;
+
+      running = std::static_pointer_cast<task_node>(shared_from_this());
+    }
+
+    task->finish();
+  }
+
+  /* task_base::observer */
+  void completed() {
+    std::unique_lock<std::mutex> l(mutex);
 
-  std::string get_name() { return thread->get_name(); }
+    finished = true;
+
+    cond.notify_all();
+
+    std::shared_ptr<task_node> first = std::move(next);
+    std::pmr::vector<std::shared_ptr<task_node>> s = std::move(more);
+
+    /* those of vthread::join() recheck and suspend again until it is done */
+    std::vector<std::shared_ptr<vthread>> j = std::move(joiners);
+
+    /* not the last reference if the task finished within run_task() */
+    std::shared_ptr<task_node> self = std::move(running);
+
+    int n = get_node();
+
+    /* 'this' may be gone as soon as the lock is released */
+    l.unlock();
+
+    /* run successors on the NUMA node of their predecessor, the first one
+     * right after this node on the same worker if the task finished here */
+    {
+      executor::handoff h(this);
+
+      auto start = [n](task_node *node) {
+        if (n >= 0)
+          node->prefer_node(n);
+
+        node->notify();
+      };
+
+      if (first)
+        start(first.get());
+
+      for (auto &node : s)
+        start(node.get());
+    }
+
+    /* hands the references over, the last one of a joiner must not be dropped
+     * here, e.g. on the task's own thread */
+    for (auto &t : j)
+      vthread::resume(std::move(t));
+
+    /* the last reference may be ours, which must not be dropped on a thread
+     * of the task's own either, e.g. one it joins when destroyed */
+    if (self && !vthread::is_managed_thread())
+      std::make_shared<vthread>("release", get_executor())
+          ->start([self = std::move(self)]() {});
+  }
 };
 
 } // namespace details
@@ -0,0 +1,103 @@
+// === (C) 2020-2024 === parallel_f / test_affinity (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include <mutex>
+#include <set>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: affinity == testing example
+
+static int data[64];
+
+/*
+ * While a task working on 'data' keeps its worker busy, 'count' more tasks on
+ * 'data' are started from outside the executor. Returns the threads they ran
+ * on other than that worker's. A few wait for the busy worker, more spill.
+ */
+static int run_beside(parallel_f::executor &exec, int count) {
+  std::atomic<bool> started(false), go(false);
+  std::atomic<int> ran(0);
+  std::thread::id busy;
+  std::mutex lock;
+  std::set<std::thread::id> others;
+
+  parallel_f::affinity a(data);
+
+  parallel_f::task_queue first(exec);
+
+  first.push(parallel_f::make_task(a, [&]() {
+    busy = std::this_thread::get_id();
+    started = true;
+
+    while (!go)
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }));
+
+  auto j = first.exec(true);
+
+  while (!started)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+  parallel_f::task_list more(exec);
+
+  for (int i = 0; i < count; i++)
+    more.append(parallel_f::make_task(a, [&]() {
+      if (std::this_thread::get_id() != busy) {
+        std::unique_lock<std::mutex> l(lock);
+
+        others.insert(std::this_thread::get_id());
+      }
+
+      ran++;
+    }));
+
+  auto m = more.finish(true);
+
+  /* spilled ones run meanwhile, those waiting for the worker don't */
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+  while (count > 4 && others.empty() &&
+         std::chrono::steady_clock::now() < until)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  go = true;
+
+  j.join();
+  m.join();
+
+  return ran == count ? (int)others.size() : -1;
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  auto &stats = parallel_f::stats::instance::get();
+
+  parallel_f::executor exec("affine");
+
+  // up to four wait for the worker which ran the same data last
+  int stayed = run_beside(exec, 4);
+  unsigned int kept = stats.get_count("affine.affinity.kept");
+
+  // more than that spill to other workers, if there are any
+  int spilled = 0;
+  unsigned int moved = 0;
+  bool spill = true;
+
+  if (parallel_f::budget::instance().capacity() > 1) {
+    spilled = run_beside(exec, 32);
+    moved = stats.get_count("affine.affinity.moved");
+    spill = spilled > 0 && moved > 0;
+  } else
+    parallel_f::log_info("single CPU, skipping the overloaded worker\n");
+
+  parallel_f::log_info("others %d, kept %u, spilled to %d others, moved %u\n",
+                       stayed, kept, spilled, moved);
+
+  stats.show_stats();
+
+  return (stayed == 0 && kept >= 4 && spill) ? 0 : 1;
+}
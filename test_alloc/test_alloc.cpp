@@ -0,0 +1,114 @@
+// === (C) 2020-2024 === parallel_f / test_alloc (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include <cstdlib>
+#include <new>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: heap allocations == testing example
+
+static std::atomic<long> allocations(0);
+
+/* counts every allocation, 'alloc.heap' only sees those of the scheduler */
+void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+static const int task_count = 10000;
+
+/* makes a batch of tasks for 'run', returns the allocations of running it */
+template <typename Run> static long count(Run run) {
+  std::vector<std::shared_ptr<parallel_f::task_base>> tasks;
+
+  tasks.reserve(task_count);
+
+  for (int i = 0; i < task_count; i++)
+    tasks.push_back(parallel_f::make_task([]() {}));
+
+  long before = allocations.load();
+
+  run(tasks);
+
+  return allocations.load() - before;
+}
+
+/* the second batch, the first one warms up slabs, fibers and workers */
+template <typename Run> static long steady(Run run) {
+  count(run);
+
+  return count(run);
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  using tasks_t = std::vector<std::shared_ptr<parallel_f::task_base>>;
+
+  long queue = steady([](tasks_t &tasks) {
+    parallel_f::task_queue q;
+
+    for (auto &t : tasks)
+      q.push(t);
+
+    q.exec();
+  });
+
+  long chain = steady([](tasks_t &tasks) {
+    parallel_f::task_list l;
+    parallel_f::task_id id = 0;
+
+    for (auto &t : tasks)
+      id = id ? l.append(t, id) : l.append(t);
+
+    l.finish();
+  });
+
+  long windowed_queue = steady([](tasks_t &tasks) {
+    parallel_f::task_queue q;
+
+    q.set_window(16);
+
+    for (auto &t : tasks)
+      q.push(t);
+
+    q.exec();
+  });
+
+  long windowed_list = steady([](tasks_t &tasks) {
+    parallel_f::task_list l;
+
+    l.set_window(16);
+
+    for (auto &t : tasks)
+      l.append(t);
+
+    l.finish(true).join();
+  });
+
+  parallel_f::log_info("allocations per %d tasks: queue %ld, chained list %ld, "
+                       "windowed queue %ld, windowed list %ld\n",
+                       task_count, queue, chain, windowed_queue,
+                       windowed_list);
+
+  parallel_f::stats::instance::get().show_stats();
+
+  /* a few per batch, none per task */
+  long limit = 64;
+
+  return (queue < limit && chain < limit && windowed_queue < limit &&
+          windowed_list < limit)
+             ? 0
+             : 1;
+}
@@ -0,0 +1,83 @@
+// === (C) 2020-2024 === parallel_f / test_blocking (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: blocking compensation == testing example
+
+/* waits up to five seconds for 'flag', optionally within a blocking section,
+ * returns false on timeout */
+static bool wait_for(std::atomic<bool> &flag, bool block) {
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+
+  std::unique_ptr<parallel_f::blocking> b;
+
+  if (block)
+    b = std::make_unique<parallel_f::blocking>();
+
+  while (!flag) {
+    if (std::chrono::steady_clock::now() > until)
+      return false;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  return true;
+}
+
+/* 'blockers' tasks occupy every worker of 'exec' until a task appended after
+ * them has run, returns true if it did while they were waiting */
+static bool block_all(parallel_f::executor &exec, int blockers, bool block) {
+  std::atomic<bool> released(false);
+  std::atomic<int> timeouts(0);
+
+  parallel_f::task_list list(exec);
+
+  for (int i = 0; i < blockers; i++)
+    list.append(parallel_f::make_task([&]() {
+      if (!wait_for(released, block))
+        timeouts++;
+    }));
+
+  list.append(parallel_f::make_task([&]() { released = true; }));
+
+  list.finish();
+
+  return released && !timeouts;
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  auto &stats = parallel_f::stats::instance::get();
+
+  parallel_f::topology::config config;
+
+  config.max_workers = 1;
+  config.max_compensation = 2;
+
+  // both blockers mark their section, a spare worker is added for each
+  parallel_f::executor marked("marked", config);
+
+  bool progress = block_all(marked, 2, true);
+  unsigned int compensated = stats.get_count("marked.compensated");
+
+  // the monitor notices a worker sleeping in the kernel without a mark
+  parallel_f::executor detected("detected", config);
+
+  detected.set_block_detection(std::chrono::milliseconds(20));
+
+  bool detection = block_all(detected, 1, false);
+  unsigned int compensated_detected = stats.get_count("detected.compensated");
+
+  parallel_f::log_info("marked: progress %d, compensated %u, "
+                       "detected: progress %d, compensated %u\n",
+                       progress, compensated, detection, compensated_detected);
+
+  stats.show_stats();
+
+  return (progress && compensated && detection && compensated_detected) ? 0
+                                                                         : 1;
+}
@@ -0,0 +1,116 @@
+// === (C) 2020-2024 === parallel_f / test_cancel (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: cancel_token == testing example
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  parallel_f::topology::config config;
+
+  config.max_workers = 1;
+  config.max_compensation = 0;
+
+  // one worker, so a ready task waits in its deque behind the running one
+  parallel_f::executor one("one", config);
+
+  auto token = parallel_f::cancel_token::make();
+
+  parallel_f::task_list list(one);
+
+  list.set_cancel_token(token);
+
+  std::atomic<bool> started(false), noticed(false);
+  std::atomic<bool> ran_ready(false), ran_dep(false), ran_dep2(false);
+
+  auto running = parallel_f::make_task([&]() {
+    started = true;
+
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+    while (!parallel_f::cancelled() && std::chrono::steady_clock::now() < until)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    noticed = parallel_f::cancelled();
+  });
+  auto ready = parallel_f::make_task([&]() { ran_ready = true; });
+  auto dep = parallel_f::make_task([&]() { ran_dep = true; });
+  auto dep2 = parallel_f::make_task([&]() { ran_dep2 = true; });
+
+  auto id = list.append(running);
+
+  list.append(ready);
+
+  auto dep_id = list.append(dep, id);
+
+  list.append(dep2, dep_id);
+
+  auto j = list.finish(true);
+
+  while (!started)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  token.cancel();
+
+  j.join();
+
+  bool skipped = !ran_ready && !ran_dep && !ran_dep2 &&
+                 ready->is_cancelled() && dep->is_cancelled() &&
+                 dep2->is_cancelled() && !running->is_cancelled();
+
+  parallel_f::log_info("cancel: noticed %d, skipped %d\n", (bool)noticed,
+                       skipped);
+
+  // a timeout passing while the predecessor runs, its successor still runs
+  std::atomic<bool> ran_late(false), ran_after(false);
+
+  parallel_f::task_list timed;
+
+  auto slow = parallel_f::make_task(
+      []() { std::this_thread::sleep_for(std::chrono::milliseconds(50)); });
+  auto late = parallel_f::make_task([&]() { ran_late = true; });
+  auto after = parallel_f::make_task([&]() { ran_after = true; });
+
+  late->set_timeout(std::chrono::milliseconds(10));
+
+  auto slow_id = timed.append(slow);
+  auto late_id = timed.append(late, slow_id);
+
+  timed.append(after, late_id);
+
+  timed.finish();
+
+  bool timed_out = !ran_late && late->is_cancelled() && ran_after;
+
+  parallel_f::log_info("timeout: skipped %d\n", timed_out);
+
+  // per task timeouts derived from a long-lived token
+  auto session = parallel_f::cancel_token::make();
+  std::atomic<int> count(0);
+
+  for (int round = 0; round < 100; round++) {
+    parallel_f::task_list l;
+
+    l.set_cancel_token(session);
+
+    for (int i = 0; i < 100; i++) {
+      auto t = parallel_f::make_task([&count]() { count++; });
+
+      t->set_timeout(std::chrono::seconds(10));
+
+      l.append(t);
+    }
+
+    l.finish();
+  }
+
+  parallel_f::log_info("session: %d tasks\n", (int)count);
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return (noticed && skipped && timed_out && count == 10000) ? 0 : 1;
+}
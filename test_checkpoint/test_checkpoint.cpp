@@ -0,0 +1,78 @@
+// === (C) 2020-2024 === parallel_f / test_checkpoint (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: checkpoint time slicing == testing example
+
+using parallel_f::priority;
+
+/*
+ * A 'long_prio' task calling checkpoint() keeps the single worker of 'exec'
+ * busy until a 'short_prio' task started meanwhile has run, or two seconds
+ * passed. Returns true if the short task ran in between and the long one was
+ * rescheduled afterwards to notice it.
+ */
+static bool slice(parallel_f::executor &exec, priority long_prio,
+                  priority short_prio) {
+  std::atomic<bool> started(false), short_done(false), noticed(false);
+
+  parallel_f::task_queue long_queue(exec);
+
+  long_queue.push(parallel_f::make_task(long_prio, [&]() {
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+    started = true;
+
+    while (!short_done && std::chrono::steady_clock::now() < until)
+      parallel_f::checkpoint();
+
+    noticed = short_done.load();
+  }));
+
+  auto l = long_queue.exec(true);
+
+  while (!started)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+  parallel_f::task_queue short_queue(exec);
+
+  short_queue.push(
+      parallel_f::make_task(short_prio, [&]() { short_done = true; }));
+
+  short_queue.exec();
+
+  l.join();
+
+  return noticed;
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  parallel_f::topology::config config;
+
+  config.max_workers = 1;
+
+  parallel_f::executor exec("slice", config);
+
+  exec.set_quantum(std::chrono::milliseconds(2));
+  exec.set_aging(std::chrono::seconds(10));
+
+  // normal work waiting yields a background task, realtime a normal one
+  bool background = slice(exec, priority::background, priority::normal);
+  bool normal = slice(exec, priority::normal, priority::realtime);
+
+  unsigned int preempted =
+      parallel_f::stats::instance::get().get_count("slice.preempted");
+
+  parallel_f::log_info("background yielded %d, normal yielded %d, "
+                       "preempted %u\n",
+                       background, normal, preempted);
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return (background && normal && preempted >= 2) ? 0 : 1;
+}
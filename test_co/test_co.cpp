@@ -0,0 +1,157 @@
+// === (C) 2020-2024 === parallel_f / test_co (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include "parallel_f.hpp"
+
+// parallel_f :: co_task == testing example
+
+static parallel_f::co_task<size_t> process(std::string filename) {
+  auto func_load = [](std::string filename) -> std::string {
+    parallel_f::log_info("Load %s...\n", filename.c_str());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    return std::string(1000, 'x');
+  };
+
+  auto func_scale = [](parallel_f::core::task_info::Value data) -> std::string {
+    parallel_f::log_info("Scale %zu bytes...\n",
+                         data.get<std::string>().size());
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    return data.get<std::string>().substr(0, 50);
+  };
+
+  auto task_load = parallel_f::make_task(func_load, filename);
+
+  auto image = co_await parallel_f::co_exec(task_load);
+
+  auto task_scale = parallel_f::make_task(func_scale, image);
+
+  parallel_f::core::task_queue tq;
+
+  tq.push(task_scale);
+
+  co_await tq.exec(true);
+
+  auto thumb = co_await task_scale->result();
+
+  parallel_f::log_info("Store %s (%zu bytes)...\n", filename.c_str(),
+                       thumb.get<std::string>().size());
+
+  co_return thumb.get<std::string>().size();
+}
+
+static parallel_f::co_task<size_t> process_all(int count) {
+  std::vector<parallel_f::co_task<size_t>> items;
+
+  for (int i = 0; i < count; i++)
+    items.push_back(process(std::string("image") + std::to_string(i)).start());
+
+  size_t total = 0;
+
+  for (auto &item : items)
+    total += co_await item;
+
+  co_return total;
+}
+
+static parallel_f::co_task<int>
+wait_for_gate(std::shared_ptr<parallel_f::task_base> gate,
+              std::atomic<int> *waiting) {
+  (*waiting)++;
+
+  co_await gate;
+
+  co_return 1;
+}
+
+/* co_tasks of a list suspended on a gate, returns the fibers their executor
+ * made meanwhile, which stays below one per co_task */
+static unsigned int suspended_fibers(int count, int &total) {
+  parallel_f::executor exec("suspended");
+  std::atomic<int> waiting(0);
+  std::atomic<bool> open(false);
+
+  auto gate = parallel_f::make_task([&open]() {
+    parallel_f::blocking b;
+
+    while (!open)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  });
+
+  parallel_f::core::task_queue gq;
+
+  gq.push(gate);
+
+  auto gj = gq.exec(true);
+
+  std::vector<parallel_f::co_task<int>> items;
+  parallel_f::core::task_list tl(exec);
+
+  for (int i = 0; i < count; i++) {
+    items.push_back(wait_for_gate(gate, &waiting));
+
+    tl.append(items.back().task());
+  }
+
+  auto j = tl.finish(true);
+
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+  while (waiting < count && std::chrono::steady_clock::now() < until)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  unsigned int fibers =
+      parallel_f::stats::instance::get().get_count("suspended.fibers");
+
+  open = true;
+
+  gj.join();
+  j.join();
+
+  total = 0;
+
+  for (auto &item : items)
+    total += item.get();
+
+  return fibers;
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  size_t total = process_all(8).get();
+
+  parallel_f::log_info("Total %zu bytes\n", total);
+
+  // co_task being part of a task_list
+  parallel_f::core::task_list tl;
+
+  auto co = process("listed");
+
+  auto co_id = tl.append(co.task());
+
+  tl.append(parallel_f::make_task([](parallel_f::core::task_info::Value v) {
+              parallel_f::log_info("After co_task: %zu\n", v.get<size_t>());
+            },
+                                  co.result()),
+            co_id);
+
+  tl.finish();
+
+  // suspended co_tasks of a list don't keep their nodes' fibers
+  int done = 0;
+  unsigned int fibers = suspended_fibers(64, done);
+
+  parallel_f::log_info("64 co_tasks suspended with %u fibers, %d done\n",
+                       fibers, done);
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return (total == 8 * 50 && fibers < 32 && done == 64) ? 0 : 1;
+}
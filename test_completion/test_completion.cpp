@@ -0,0 +1,186 @@
+// === (C) 2020-2024 === parallel_f / test_completion (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include <thread>
+#include <vector>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: completion == testing example
+
+static std::atomic<int> errors(0);
+
+/* counts its calls, which must not happen once it has been detached */
+class probe : public parallel_f::completion::waiter {
+public:
+  std::atomic<int> calls{0};
+  std::atomic<bool> gone{false};
+
+  void completed() {
+    if (gone || calls++)
+      errors++;
+  }
+};
+
+/* detaches itself when called */
+class self_detaching : public parallel_f::completion::waiter {
+public:
+  parallel_f::completion *owner = nullptr;
+  int calls = 0;
+
+  void completed() {
+    calls++;
+
+    owner->detach(this);
+  }
+};
+
+/* detaches another waiter of 'owner' when called */
+class other_detaching : public parallel_f::completion::waiter {
+public:
+  parallel_f::completion *owner = nullptr;
+  parallel_f::completion::waiter *other = nullptr;
+  int calls = 0;
+
+  void completed() {
+    calls++;
+
+    owner->detach(other);
+  }
+};
+
+/* completes another completion when called */
+class completing : public parallel_f::completion::waiter {
+public:
+  parallel_f::completion *next = nullptr;
+
+  void completed() { next->complete(); }
+};
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  const int rounds = 200;
+  const int detachers = 4;
+  const int per_detacher = 64;
+  const int kept_count = 4096;
+
+  int called = 0, detached = 0;
+
+  // detachers racing each other and complete(), behind a long list of kept
+  // waiters, so they often get preempted while holding it
+  for (int r = 0; r < rounds; r++) {
+    parallel_f::completion c;
+    std::vector<probe> kept(kept_count);
+    std::vector<std::vector<probe>> dropped(detachers);
+    std::atomic<int> ready(0);
+
+    for (auto &d : dropped) {
+      d = std::vector<probe>(per_detacher);
+
+      for (auto &p : d)
+        c.add(&p);
+    }
+
+    for (auto &p : kept)
+      c.add(&p);
+
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < detachers; t++) {
+      threads.emplace_back([&, t]() {
+        ready++;
+
+        while (ready < detachers + 1)
+          std::this_thread::yield();
+
+        for (auto &p : dropped[t]) {
+          c.detach(&p);
+
+          p.gone = true;
+        }
+      });
+    }
+
+    ready++;
+
+    while (ready < detachers + 1)
+      std::this_thread::yield();
+
+    /* let some detaches go first now and then */
+    if (r & 1)
+      std::this_thread::yield();
+
+    c.complete();
+
+    for (auto &t : threads)
+      t.join();
+
+    for (auto &p : kept) {
+      if (p.calls != 1)
+        errors++;
+    }
+
+    for (auto &d : dropped) {
+      for (auto &p : d) {
+        if (p.calls)
+          called++;
+        else
+          detached++;
+      }
+    }
+  }
+
+  // detaching the waiter being called, from its callback
+  parallel_f::completion c;
+  self_detaching s;
+  probe after;
+
+  s.owner = &c;
+
+  c.add(&s);
+  c.add(&after);
+  c.complete();
+
+  bool self = s.calls == 1 && after.calls == 1;
+
+  // detaching a later waiter from a callback, it must not be called
+  parallel_f::completion c2;
+  other_detaching o;
+  probe skipped, kept;
+
+  o.owner = &c2;
+  o.other = &skipped;
+
+  c2.add(&o);
+  c2.add(&skipped);
+  c2.add(&kept);
+  c2.complete();
+
+  bool other = o.calls == 1 && !skipped.calls && kept.calls == 1;
+
+  // detaching from a completion firing further up the stack
+  parallel_f::completion outer, inner;
+  completing via;
+  other_detaching nested;
+  probe skipped_outer;
+
+  via.next = &inner;
+  nested.owner = &outer;
+  nested.other = &skipped_outer;
+
+  outer.add(&via);
+  outer.add(&skipped_outer);
+  inner.add(&nested);
+  outer.complete();
+
+  bool stacked = nested.calls == 1 && !skipped_outer.calls;
+
+  parallel_f::log_info("detached %d, called before detaching %d, self %d, "
+                       "other %d, stacked %d, %d errors\n",
+                       detached, called, self, other, stacked, (int)errors);
+
+  return (!errors && self && other && stacked) ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+// === (C) 2020-2024 === parallel_f / test_deadline (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include <mutex>
+#include <string>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: earliest deadline first == testing example
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  auto &stats = parallel_f::stats::instance::get();
+
+  parallel_f::topology::config config;
+
+  config.max_workers = 1;
+
+  parallel_f::executor exec("edf", config);
+
+  exec.set_aging(std::chrono::seconds(10));
+
+  std::mutex lock;
+  std::string order;
+
+  auto mark = [&](char c) {
+    return parallel_f::make_task([&lock, &order, c]() {
+      std::unique_lock<std::mutex> l(lock);
+
+      order += c;
+    });
+  };
+
+  // keeps the single worker busy until everything is queued
+  std::atomic<bool> started(false), go(false);
+
+  parallel_f::task_queue gate(exec);
+
+  gate.push(parallel_f::make_task([&]() {
+    started = true;
+
+    while (!go)
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }));
+
+  auto g = gate.exec(true);
+
+  while (!started)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+  // batches started latest deadline first, plus a normal and a realtime task
+  auto now = std::chrono::steady_clock::now();
+
+  std::vector<parallel_f::joinable> joins;
+
+  auto start = [&](char c, parallel_f::priority p,
+                   std::chrono::steady_clock::time_point deadline) {
+    parallel_f::task_queue q(exec);
+
+    auto t = mark(c);
+
+    t->set_priority(p);
+
+    q.push(t);
+
+    joins.push_back(deadline.time_since_epoch().count()
+                        ? q.exec(deadline, true)
+                        : q.exec(true));
+  };
+
+  using parallel_f::priority;
+
+  start('n', priority::normal, {});
+  start('3', priority::normal, now + std::chrono::seconds(3));
+  start('2', priority::normal, now + std::chrono::seconds(2));
+  start('1', priority::normal, now + std::chrono::seconds(1));
+  start('r', priority::realtime, {});
+
+  go = true;
+
+  g.join();
+
+  for (auto &j : joins)
+    j.join();
+
+  // a deadline already passed when the batch runs
+  parallel_f::task_queue late(exec);
+
+  late.push(mark('x'));
+  late.exec(std::chrono::steady_clock::now() - std::chrono::milliseconds(1));
+
+  /* the last one is counted once its worker is back from it */
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+  while (stats.get_count("edf.deadline.met") +
+                 stats.get_count("edf.deadline.missed") <
+             4 &&
+         std::chrono::steady_clock::now() < until)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  unsigned int met = stats.get_count("edf.deadline.met");
+  unsigned int missed = stats.get_count("edf.deadline.missed");
+
+  parallel_f::log_info("order %s, deadlines met %u, missed %u\n",
+                       order.c_str(), met, missed);
+
+  stats.show_stats();
+
+  return (order == "r123nx" && met == 3 && missed == 1) ? 0 : 1;
+}
@@ -0,0 +1,98 @@
+// === (C) 2020-2024 === parallel_f / test_executor (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: executor == testing example
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  parallel_f::topology::config config;
+
+  config.max_workers = 1;
+
+  // a separate pool for blocking loads, capped to one worker
+  parallel_f::executor io("io", config);
+  parallel_f::executor &cpu = parallel_f::executor::instance();
+
+  std::atomic<int> errors(0);
+
+  auto expect = [&errors](parallel_f::executor *exec, const char *what) {
+    if (parallel_f::executor::current_executor() != exec) {
+      parallel_f::log_info("%s running on wrong executor\n", what);
+      errors++;
+    }
+  };
+
+  auto load = [&](int i) -> int {
+    expect(&io, "load");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    return i;
+  };
+
+  auto process = [&](parallel_f::core::task_info::Value v) -> int {
+    expect(&cpu, "process");
+
+    return v.get<int>() * 2;
+  };
+
+  // loads on 'io' feeding processing on the default executor
+  parallel_f::task_list loads(io);
+  parallel_f::task_list work;
+
+  std::vector<std::shared_ptr<
+      parallel_f::task<decltype(process), parallel_f::future_value<int>>>>
+      results;
+
+  // waits for the loads by joining the io list, suspending instead of blocking
+  auto gate = work.append(parallel_f::make_task([&]() {
+    expect(&cpu, "gate");
+
+    loads.finish();
+  }));
+
+  for (int i = 0; i < 4; i++) {
+    auto l = parallel_f::make_task(load, i);
+    auto p = parallel_f::make_task(process, l->result());
+
+    loads.append(l);
+    work.append(p, gate);
+
+    results.push_back(p);
+  }
+
+  work.finish();
+
+  int sum = 0;
+
+  for (auto &r : results)
+    sum += r->result().get<int>();
+
+  parallel_f::log_info("sum %d, %d errors\n", sum, (int)errors);
+
+  // a queue running on 'io' awaited from the default executor
+  parallel_f::task_queue q(io);
+
+  q.push(parallel_f::make_task([&]() { expect(&io, "queue"); }));
+
+  parallel_f::task_list outer;
+
+  outer.append(parallel_f::make_task([&]() {
+    expect(&cpu, "outer");
+
+    q.exec();
+
+    expect(&cpu, "outer after join");
+  }));
+
+  outer.finish();
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return (sum == 12 && !errors) ? 0 : 1;
+}
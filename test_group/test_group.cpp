@@ -0,0 +1,75 @@
+// === (C) 2020-2024 === parallel_f / test_group (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: task_group == testing example
+
+static void sort(std::vector<int>::iterator begin,
+                 std::vector<int>::iterator end) {
+  if (end - begin < 1000) {
+    std::sort(begin, end);
+    return;
+  }
+
+  auto pivot = *(begin + (end - begin) / 2);
+  auto mid1 = std::partition(begin, end, [pivot](int v) { return v < pivot; });
+  auto mid2 = std::partition(mid1, end, [pivot](int v) { return v == pivot; });
+
+  parallel_f::task_group g;
+
+  g.spawn([=]() { sort(begin, mid1); });
+
+  sort(mid2, end);
+
+  g.wait();
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  std::vector<int> values(1000000);
+
+  std::iota(values.begin(), values.end(), 0);
+  std::shuffle(values.begin(), values.end(), std::mt19937(42));
+
+  // recursive spawns from within a task
+  parallel_f::task_queue q;
+
+  q.push(parallel_f::make_task([&]() { sort(values.begin(), values.end()); }));
+
+  q.exec();
+
+  bool sorted = std::is_sorted(values.begin(), values.end());
+
+  // spawns from the main thread, a failing job
+  std::atomic<int> sum(0);
+  bool caught = false;
+
+  try {
+    parallel_f::task_group g;
+
+    for (int i = 0; i < 100; i++)
+      g.spawn([&sum, i]() { sum += i; });
+
+    g.spawn([]() { throw std::runtime_error("failed"); });
+
+    g.wait();
+  } catch (const std::runtime_error &) {
+    caught = true;
+  }
+
+  parallel_f::log_info("sorted %d, sum %d, caught %d\n", sorted, (int)sum,
+                       caught);
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return (sorted && sum == 4950 && caught) ? 0 : 1;
+}
@@ -0,0 +1,82 @@
+// === (C) 2020-2024 === parallel_f / test_handoff (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: successor handoff == testing example
+
+/* waits up to two seconds for 'flag', optionally within a blocking section */
+static bool wait_for(std::atomic<bool> &flag, bool block) {
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+
+  std::unique_ptr<parallel_f::blocking> b;
+
+  if (block)
+    b = std::make_unique<parallel_f::blocking>();
+
+  while (!flag) {
+    if (std::chrono::steady_clock::now() > until)
+      return false;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  return true;
+}
+
+/* a task starting a queue and waiting for it without joining */
+static bool start_and_wait(bool block) {
+  std::atomic<bool> ran(false);
+  bool seen = false;
+
+  parallel_f::task_queue outer;
+
+  outer.push(parallel_f::make_task([&]() {
+    parallel_f::task_queue inner;
+
+    inner.push(parallel_f::make_task([&]() { ran = true; }));
+
+    auto j = inner.exec(true);
+
+    seen = wait_for(ran, block);
+
+    j.join();
+  }));
+
+  outer.exec();
+
+  return seen;
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  // a chain handing each successor to the finishing worker
+  std::atomic<int> count(0);
+  parallel_f::task_queue chain;
+
+  for (int i = 0; i < 1000; i++)
+    chain.push(parallel_f::make_task([&count]() { count++; }));
+
+  chain.exec();
+
+  // work started by a task which keeps its worker, a spare runs it
+  bool blocked = start_and_wait(true);
+
+  // same without a blocking section, needs another regular worker
+  bool busy = true;
+
+  if (parallel_f::budget::instance().capacity() > 1)
+    busy = start_and_wait(false);
+  else
+    parallel_f::log_info("single CPU, skipping the busy starter\n");
+
+  parallel_f::log_info("chain %d, blocked %d, busy %d\n", (int)count, blocked,
+                       busy);
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return (count == 1000 && blocked && busy) ? 0 : 1;
+}
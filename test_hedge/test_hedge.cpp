@@ -0,0 +1,90 @@
+// === (C) 2020-2024 === parallel_f / test_hedge (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: hedged tasks == testing example
+
+/* shared by the runs of one task */
+struct probe {
+  std::atomic<int> calls{0};
+  std::atomic<int> returned{0};
+};
+
+enum mode { normal, quick, straggle };
+
+/* returns the number of the run, the first one straggling if asked to */
+static int work(std::shared_ptr<probe> p, std::shared_ptr<int> payload,
+                int m) {
+  int run = p->calls++;
+
+  if (m == normal)
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  else if (m == straggle && run == 0) {
+    parallel_f::blocking b;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  }
+
+  p->returned++;
+
+  return run + *payload;
+}
+
+static std::shared_ptr<parallel_f::task<decltype(&work), std::shared_ptr<probe>,
+                                        std::shared_ptr<int>, int>>
+run(std::shared_ptr<probe> p, std::shared_ptr<int> payload, int m,
+    std::atomic<int> &finished) {
+  auto t = parallel_f::make_task(parallel_f::hedge, &work, p,
+                                 std::move(payload), m);
+
+  t->on_finished([&finished]() { finished++; });
+
+  parallel_f::task_queue q;
+
+  q.push(t);
+  q.exec();
+
+  return t;
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  parallel_f::hedging::set_min_samples(8);
+
+  std::atomic<int> finished(0);
+
+  // durations of about 20 ms for the threshold
+  for (int i = 0; i < 8; i++)
+    run(std::make_shared<probe>(), std::make_shared<int>(0), normal, finished);
+
+  // done well before the threshold, its copies must not be kept until then
+  auto payload = std::make_shared<int>(0);
+  std::weak_ptr<int> weak = payload;
+
+  run(std::make_shared<probe>(), std::move(payload), quick, finished);
+
+  bool released = weak.expired();
+
+  // the first run straggles, the copy started meanwhile wins
+  auto p = std::make_shared<probe>();
+  auto t = run(p, std::make_shared<int>(0), straggle, finished);
+
+  int value = t->result().get();
+
+  while (p->returned < 2)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+  bool once = finished == 10 && p->calls == 2 && value == 1 &&
+              t->result().get() == 1;
+
+  parallel_f::log_info("released %d, published once %d (value %d)\n",
+                       released, once, value);
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return (released && once) ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+// === (C) 2020-2024 === parallel_f / test_priority (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include <mutex>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: priority classes == testing example
+
+using parallel_f::priority;
+
+/* the classes of the tasks in the order they ran */
+class recorder {
+private:
+  std::mutex lock;
+
+public:
+  std::vector<priority> order;
+
+  void ran(priority p) {
+    std::unique_lock<std::mutex> l(lock);
+
+    order.push_back(p);
+  }
+};
+
+/*
+ * Starts 'prios' on the single worker of 'exec' while it is busy, so they are
+ * all queued before it picks the first one, each running for 'each'.
+ */
+static std::vector<priority> run_queued(parallel_f::executor &exec,
+                                        std::vector<priority> prios,
+                                        std::chrono::microseconds each) {
+  std::atomic<bool> started(false), go(false);
+  recorder r;
+
+  parallel_f::task_queue gate(exec);
+
+  gate.push(parallel_f::make_task([&]() {
+    started = true;
+
+    while (!go)
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }));
+
+  auto g = gate.exec(true);
+
+  while (!started)
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+  parallel_f::task_list list(exec);
+
+  for (auto p : prios)
+    list.append(parallel_f::make_task(p, [&r, p, each]() {
+      std::this_thread::sleep_for(each);
+
+      r.ran(p);
+    }));
+
+  auto l = list.finish(true);
+
+  go = true;
+
+  g.join();
+  l.join();
+
+  return r.order;
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  parallel_f::topology::config config;
+
+  config.max_workers = 1;
+
+  parallel_f::executor exec("prio", config);
+
+  // strict priority, appended from the lowest class up
+  exec.set_aging(std::chrono::seconds(10));
+
+  std::vector<priority> prios;
+
+  for (auto p : {priority::background, priority::normal, priority::realtime})
+    for (int i = 0; i < 4; i++)
+      prios.push_back(p);
+
+  auto order = run_queued(exec, prios, std::chrono::microseconds(0));
+
+  bool strict = order.size() == prios.size() &&
+                std::is_sorted(order.begin(), order.end());
+
+  // a background task behind a stream of realtime ones, which ages
+  exec.set_aging(std::chrono::milliseconds(10));
+
+  std::vector<priority> stream(40, priority::realtime);
+
+  stream.insert(stream.begin(), priority::background);
+
+  auto aged = run_queued(exec, stream, std::chrono::milliseconds(2));
+
+  size_t position =
+      std::find(aged.begin(), aged.end(), priority::background) - aged.begin();
+
+  parallel_f::log_info("strict order %d, background ran %zu. of %zu\n", strict,
+                       position + 1, aged.size());
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return (strict && position + 1 < aged.size()) ? 0 : 1;
+}
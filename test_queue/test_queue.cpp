@@ -84,7 +84,102 @@ int main() {
 
   j.add(tq.exec(true));
 
+  // round 4 = typed results, read in place by two tasks, then moved out
+  auto func4 = [](parallel_f::future_value<std::string> msg) -> size_t {
+    parallel_f::log_info("Fourth function reading '%s'\n", msg.get().c_str());
+
+    return msg.get().size();
+  };
+
+  auto task41 = parallel_f::make_task(func1);
+  auto task42 = parallel_f::make_task(func4, task41->result());
+  auto task43 = parallel_f::make_task(func4, task41->result());
+
+  tq.push(task41);
+  tq.push(task42);
+  tq.push(task43);
+
+  j.add(tq.exec(true));
+
   j.join_all();
 
+  std::string hello = task41->result().take();
+
+  // round 5 = tasks and nodes allocated from a memory resource of our own
+  static std::pmr::synchronized_pool_resource pool;
+
+  parallel_f::task_queue tq5(&pool);
+
+  auto task51 = parallel_f::make_task(
+      std::allocator_arg, std::pmr::polymorphic_allocator<std::byte>(&pool),
+      func1);
+  auto task52 = parallel_f::make_task(
+      std::allocator_arg, std::pmr::polymorphic_allocator<std::byte>(&pool),
+      func4, task51->result());
+
+  tq5.push(task51);
+  tq5.push(task52);
+
+  tq5.exec(true).join();
+
+  // round 6 = a move-only result, taken by the dependent task
+  auto task61 = parallel_f::make_task([]() { return std::make_unique<int>(42); });
+  auto task62 = parallel_f::make_task(
+      [](parallel_f::future_value<std::unique_ptr<int>> p) {
+        return *p.take() + 1;
+      },
+      task61->result());
+
+  tq.push(task61);
+  tq.push(task62);
+
+  // round 7 = a callable returning a reference, the value is stored
+  int counter = 7;
+
+  auto task71 = parallel_f::make_task([&counter]() -> int & { return counter; });
+  auto task72 = parallel_f::make_task([]() -> const std::string {
+    return "const";
+  });
+
+  tq.push(task71);
+  tq.push(task72);
+
+  tq.exec();
+
+  counter = 8;
+
+  // round 8 = a move-only callable and arguments, moved into the task
+  auto owned = std::make_unique<int>(5);
+  auto arg = std::make_unique<int>(10);
+
+  auto task81 = parallel_f::make_task(
+      [owned = std::move(owned)](std::unique_ptr<int> a,
+                                 std::unique_ptr<int> b) {
+        return *owned + *a + *b;
+      },
+      std::move(arg), std::make_unique<int>(100));
+  auto task82 = parallel_f::make_task(
+      [](std::unique_ptr<int> a) { return std::move(a); },
+      std::make_unique<int>(1000));
+
+  tq.push(task81);
+  tq.push(task82);
+
+  tq.exec();
+
+  std::unique_ptr<int> moved = task82->result().take();
+
+  bool move_only =
+      !arg && task81->result().get() == 115 && moved && *moved == 1000;
+
+  bool typed = task62->result().get() == 43 && !task61->result().ready() &&
+               task71->result().get() == 7 && task72->result().get() == "const";
+
   parallel_f::stats::instance::get().show_stats();
+
+  return hello == "Hello World" && task42->result().get() == hello.size() &&
+                 task43->result().get() == hello.size() &&
+                 task52->result().get() == hello.size() && typed && move_only
+             ? 0
+             : 1;
 }
@@ -0,0 +1,101 @@
+// === (C) 2020-2024 === parallel_f / test_static_graph (tasks, queues, lists
+// in parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include <array>
+#include <atomic>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: static_graph == testing example
+
+using parallel_f::node;
+
+/* the shape of test_list */
+typedef parallel_f::static_graph<
+    node<0>, node<1>, node<2>, node<3>, node<4, 0, 1>, node<5, 1, 2>,
+    node<6, 2, 3>, node<7, 4>, node<8, 5>, node<9, 6>, node<10, 7, 8, 9>,
+    node<11, 7, 8, 9>, node<12, 7, 8, 9>, node<13, 7, 8, 9>, node<14, 7>,
+    node<15, 8>, node<16, 9>>
+    shape;
+
+static const std::array<std::vector<int>, shape::size> deps = {
+    {{}, {}, {}, {}, {0, 1}, {1, 2}, {2, 3}, {4}, {5}, {6}, {7, 8, 9},
+     {7, 8, 9}, {7, 8, 9}, {7, 8, 9}, {7}, {8}, {9}}};
+
+int main() {
+  parallel_f::set_debug_level(0);
+
+  std::atomic<int> counter(0);
+  std::array<int, shape::size> order;
+
+  auto func = [&](int i) {
+    parallel_f::log_info("Function %d\n", i);
+
+    {
+      parallel_f::blocking b;
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    order[i] = ++counter;
+
+    parallel_f::log_info("Function %d done.\n", i);
+  };
+
+  std::array<std::shared_ptr<parallel_f::task_base>, shape::size> tasks;
+
+  for (int i = 0; i < (int)shape::size; i++)
+    tasks[i] = parallel_f::make_task(func, i);
+
+  shape g(tasks);
+
+  g.finish();
+
+  bool ok = counter == (int)shape::size;
+
+  for (size_t i = 0; i < shape::size; i++) {
+    for (int d : deps[i]) {
+      if (order[d] > order[i]) {
+        parallel_f::log_info("Task %zu ran before %d!\n", i, d);
+        ok = false;
+      }
+    }
+  }
+
+  // once more detached, joined via then()
+  std::atomic<int> sum(0);
+
+  auto add = [&](int v) { sum += v; };
+
+  typedef parallel_f::static_graph<node<0>, node<1, 0>, node<2, 0>,
+                                   node<3, 1, 2>>
+      diamond;
+
+  diamond d(parallel_f::make_task(add, 1), parallel_f::make_task(add, 2),
+            parallel_f::make_task(add, 3), parallel_f::make_task(add, 4));
+
+  std::mutex lock;
+  std::condition_variable cond;
+  bool done = false;
+
+  d.finish(true).then([&]() {
+    std::unique_lock<std::mutex> l(lock);
+
+    done = true;
+
+    cond.notify_one();
+  });
+
+  {
+    std::unique_lock<std::mutex> l(lock);
+
+    while (!done)
+      cond.wait(l);
+  }
+
+  parallel_f::log_info("Diamond sum %d\n", sum.load());
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return ok && sum == 10 ? 0 : 1;
+}
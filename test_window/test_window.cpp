@@ -0,0 +1,142 @@
+// === (C) 2020-2024 === parallel_f / test_window (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#include "../parallel_f.hpp"
+
+// parallel_f :: submission window == testing example
+
+static const int window_size = 4;
+static const int task_count = 200;
+
+/* appends to a windowed list, checking the tasks not finished yet each time */
+static int fill_list(parallel_f::backpressure mode) {
+  std::atomic<int> finished(0);
+  int peak = 0;
+
+  parallel_f::task_list list;
+
+  list.set_window(window_size, 0, mode);
+
+  for (int i = 0; i < task_count; i++) {
+    list.append(parallel_f::make_task([&finished]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+      finished++;
+    }));
+
+    peak = std::max(peak, i + 1 - finished);
+  }
+
+  list.finish();
+
+  return finished == task_count ? peak : -1;
+}
+
+/* same for a queue, bounded by bytes, every task costing a quarter */
+static int fill_queue(parallel_f::backpressure mode) {
+  std::atomic<int> finished(0);
+  int peak = 0;
+
+  parallel_f::task_queue queue;
+
+  queue.set_window(0, window_size * 1000, mode);
+
+  for (int i = 0; i < task_count; i++) {
+    auto t = parallel_f::make_task([&finished]() {
+      std::this_thread::sleep_for(std::chrono::microseconds(200));
+
+      finished++;
+    });
+
+    t->set_cost(1000);
+
+    queue.push(t);
+
+    peak = std::max(peak, i + 1 - finished);
+  }
+
+  queue.exec();
+
+  return finished == task_count ? peak : -1;
+}
+
+/* a windowed queue with a deadline, returns the tasks counted met or missed */
+static int deadline_queue() {
+  parallel_f::executor exec("window");
+  parallel_f::task_queue queue(exec);
+
+  queue.set_window(window_size);
+  queue.set_deadline(std::chrono::steady_clock::now() +
+                     std::chrono::seconds(10));
+
+  for (int i = 0; i < task_count; i++)
+    queue.push(parallel_f::make_task([]() {}));
+
+  queue.exec();
+
+  /* the last one is counted once its worker is back from it */
+  auto &stats = parallel_f::stats::instance::get();
+  auto until = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+  int counted;
+
+  while ((counted = stats.get_count("window.deadline.met") +
+                    stats.get_count("window.deadline.missed")) < task_count &&
+         std::chrono::steady_clock::now() < until)
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  return counted;
+}
+
+/* runs 'func' within a task, so waiting for room suspends or yields it */
+template <typename Func> static int in_task(Func func) {
+  int peak = -1;
+
+  parallel_f::task_queue q;
+
+  q.push(parallel_f::make_task([&]() { peak = func(); }));
+
+  q.exec();
+
+  return peak;
+}
+
+int main() {
+  parallel_f::set_debug_level(0);
+  parallel_f::system::instance().set_auto_flush(
+      parallel_f::system::AutoFlush::EndOfLine);
+
+  using parallel_f::backpressure;
+
+  int peaks[] = {
+      fill_list(backpressure::block),
+      fill_list(backpressure::yield),
+      fill_queue(backpressure::block),
+      fill_queue(backpressure::yield),
+      in_task([]() { return fill_list(backpressure::block); }),
+      in_task([]() { return fill_list(backpressure::yield); }),
+      in_task([]() { return fill_queue(backpressure::block); }),
+      in_task([]() { return fill_queue(backpressure::yield); }),
+  };
+
+  bool ok = true;
+
+  for (int peak : peaks) {
+    parallel_f::log_info("peak in flight %d of %d\n", peak, window_size);
+
+    if (peak < 1 || peak > window_size)
+      ok = false;
+  }
+
+  // tasks started by the window get the deadline as well
+  int deadlines = deadline_queue();
+
+  parallel_f::log_info("%d of %d tasks with a deadline\n", deadlines,
+                       task_count);
+
+  if (deadlines != task_count)
+    ok = false;
+
+  parallel_f::stats::instance::get().show_stats();
+
+  return ok ? 0 : 1;
+}
@@ -13,7 +13,11 @@ int main() {
 
     parallel_f::log_info_f("Load %s...\n", filename.c_str());
 
-    image->loadFromFile(filename);
+    {
+      parallel_f::blocking b;
+
+      image->loadFromFile(filename);
+    }
 
     return image;
   };
@@ -52,6 +56,8 @@ int main() {
 
     parallel_f::log_info_f("Store %s...\n", filename.c_str());
 
+    parallel_f::blocking b;
+
     image->saveToFile(filename);
   };
 
@@ -59,13 +65,16 @@ int main() {
 
   parallel_f::core::task_list task_list;
 
+  /* keep a bounded number of images in flight instead of queueing them all */
+  task_list.set_window(3 * 16);
+
   for (auto &p : std::filesystem::recursive_directory_iterator(".")) {
     if (p.path().string().find(".jpg") != std::string::npos) {
       std::string filename = p.path().string();
 
       auto task_load = parallel_f::make_task(func_load, filename);
-      auto task_scale =
-          parallel_f::make_task(func_scale, filename, task_load->result());
+      auto task_scale = parallel_f::make_task(parallel_f::hedge, func_scale,
+                                              filename, task_load->result());
       auto task_store = parallel_f::make_task(
           func_store, task_scale->result(),
           filename.substr(0, filename.find_last_of(".")) + "_mini.png");
@@ -0,0 +1,327 @@
+// === (C) 2020-2024 === parallel_f / topology (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "budget.hpp"
+#include "log.hpp"
+
+namespace parallel_f {
+
+// parallel_f :: topology == implementation
+
+/*
+ * CPU topology of the host as far as the calling process may use it.
+ *
+ * On Linux it is read from /sys/devices/system/cpu and /sys/devices/system/node
+ * and restricted to the process affinity mask. Elsewhere, or if /sys is not
+ * readable, every CPU reported by std::thread::hardware_concurrency() is
+ * assumed to be a separate core on node 0.
+ */
+class topology {
+public:
+  class cpu {
+  public:
+    unsigned int id;
+    unsigned int core;    // core_id, unique within the package only
+    unsigned int package; // physical_package_id
+    unsigned int node;    // index into nodes()
+    bool primary;         // first SMT sibling of its core
+  };
+
+  /* how an executor selects (and optionally pins) its workers */
+  class config {
+  public:
+    enum class policy {
+      all,      // every usable CPU, SMT siblings included
+      physical, // one CPU per physical core
+      list      // explicit CPU list
+    };
+
+    policy select;
+    std::vector<unsigned int> cpus; // for policy::list
+    unsigned int max_workers;       // zero for no limit
+    int max_compensation;           // workers added while others block, -1 for as many as selected
+    bool pin;
+    bool quota;                     // no more workers than the cgroup CPU quota allows
+
+    config()
+        : select(policy::all), max_workers(0), max_compensation(-1),
+          pin(false), quota(true) {}
+
+    /*
+     * Reads PARALLEL_F_CPUS ("all", "physical" or a CPU list like "0-7,16"),
+     * PARALLEL_F_PIN ("1" to pin workers) and PARALLEL_F_QUOTA ("0" to ignore
+     * the cgroup CPU quota), defaults to all CPUs within the quota unpinned.
+     */
+    static config from_environment() {
+      config c;
+
+      const char *cpus = std::getenv("PARALLEL_F_CPUS");
+      const char *pin = std::getenv("PARALLEL_F_PIN");
+      const char *quota = std::getenv("PARALLEL_F_QUOTA");
+
+      if (cpus) {
+        std::string s(cpus);
+
+        if (s == "physical")
+          c.select = policy::physical;
+        else if (s != "all" && !s.empty()) {
+          c.select = policy::list;
+          c.cpus = parse_list(s);
+        }
+      }
+
+      if (pin)
+        c.pin = std::string(pin) == "1";
+
+      if (quota)
+        c.quota = std::string(quota) != "0";
+
+      return c;
+    }
+  };
+
+private:
+  std::vector<cpu> cpus_;
+  unsigned int nodes_;
+
+public:
+  static const topology &get() {
+    static topology topology_instance;
+
+    return topology_instance;
+  }
+
+  topology() : nodes_(1) {
+    if (!discover())
+      fallback();
+
+    LOG_DEBUG("topology::topology(): %zu cpus, %u nodes\n", cpus_.size(),
+              nodes_);
+  }
+
+  const std::vector<cpu> &cpus() const { return cpus_; }
+
+  unsigned int nodes() const { return nodes_; }
+
+  /* the CPUs to run workers on, ordered by node so workers of a node are adjacent */
+  std::vector<cpu> select(const config &c) const {
+    std::vector<cpu> r;
+
+    for (auto &p : cpus_) {
+      switch (c.select) {
+      case config::policy::all:
+        r.push_back(p);
+        break;
+
+      case config::policy::physical:
+        if (p.primary)
+          r.push_back(p);
+        break;
+
+      case config::policy::list:
+        if (std::find(c.cpus.begin(), c.cpus.end(), p.id) != c.cpus.end())
+          r.push_back(p);
+        break;
+      }
+    }
+
+    if (r.empty()) {
+      LOG_INFO("topology::select(): no usable CPU in selection, using all\n");
+
+      r = cpus_;
+    }
+
+    std::stable_sort(r.begin(), r.end(), [](const cpu &a, const cpu &b) {
+      return a.node < b.node;
+    });
+
+    /* fill nodes one after another to keep a capped pool local */
+    if (c.max_workers && r.size() > c.max_workers)
+      r.resize(c.max_workers);
+
+    /* more workers than the quota only get throttled */
+    unsigned int q = c.quota ? budget::cpu_quota() : 0;
+
+    if (q && r.size() > q) {
+      LOG_DEBUG("topology::select(): limited to %u workers by cpu quota\n", q);
+
+      r.resize(q);
+    }
+
+    return r;
+  }
+
+  /* pin the calling thread, returns false if not supported or failed */
+  static bool pin(unsigned int id) {
+#ifdef __linux__
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(id, &set);
+
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)id;
+
+    return false;
+#endif
+  }
+
+  /* "0-3,8,10-11" */
+  static std::vector<unsigned int> parse_list(const std::string &s) {
+    std::vector<unsigned int> r;
+    std::stringstream ss(s);
+    std::string range;
+
+    while (std::getline(ss, range, ',')) {
+      if (range.empty())
+        continue;
+
+      size_t dash = range.find('-');
+
+      try {
+        unsigned int first = std::stoul(range.substr(0, dash));
+        unsigned int last =
+            dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+
+        for (unsigned int i = first; i <= last; i++)
+          r.push_back(i);
+      } catch (const std::exception &) {
+        LOG_INFO("topology::parse_list(): ignoring '%s'\n", range.c_str());
+      }
+    }
+
+    return r;
+  }
+
+private:
+  static bool read(const std::string &path, std::string &value) {
+    std::ifstream f(path);
+
+    if (!f)
+      return false;
+
+    std::getline(f, value);
+
+    return true;
+  }
+
+  static unsigned int read_uint(const std::string &path, unsigned int def) {
+    std::string value;
+
+    if (!read(path, value))
+      return def;
+
+    try {
+      return std::stoul(value);
+    } catch (const std::exception &) {
+      return def;
+    }
+  }
+
+  bool discover() {
+#ifdef __linux__
+    std::string online;
+
+    if (!read("/sys/devices/system/cpu/online", online))
+      return false;
+
+    cpu_set_t allowed;
+
+    CPU_ZERO(&allowed);
+
+    bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    /* map CPUs to nodes, node numbers may be sparse */
+    std::map<unsigned int, unsigned int> node_of;
+    std::map<unsigned int, unsigned int> node_index;
+    std::string possible;
+
+    if (read("/sys/devices/system/node/possible", possible)) {
+      for (auto n : parse_list(possible)) {
+        std::string list;
+
+        if (!read("/sys/devices/system/node/node" + std::to_string(n) +
+                      "/cpulist",
+                  list))
+          continue;
+
+        for (auto c : parse_list(list))
+          node_of[c] = n;
+      }
+    }
+
+    std::map<std::pair<unsigned int, unsigned int>, bool> cores;
+
+    for (auto id : parse_list(online)) {
+      if (masked && (id >= CPU_SETSIZE || !CPU_ISSET(id, &allowed)))
+        continue;
+
+      std::string base =
+          "/sys/devices/system/cpu/cpu" + std::to_string(id) + "/topology/";
+
+      cpu c;
+
+      c.id = id;
+      c.core = read_uint(base + "core_id", id);
+      c.package = read_uint(base + "physical_package_id", 0);
+
+      unsigned int n = node_of.count(id) ? node_of[id] : 0;
+
+      if (!node_index.count(n)) {
+        unsigned int index = (unsigned int)node_index.size();
+
+        node_index[n] = index;
+      }
+
+      c.node = node_index[n];
+
+      auto key = std::make_pair(c.package, c.core);
+
+      c.primary = !cores[key];
+
+      cores[key] = true;
+
+      cpus_.push_back(c);
+    }
+
+    if (cpus_.empty())
+      return false;
+
+    nodes_ = (unsigned int)std::max<size_t>(1, node_index.size());
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  void fallback() {
+    unsigned int n = std::max(1u, std::thread::hardware_concurrency());
+
+    cpus_.clear();
+
+    for (unsigned int i = 0; i < n; i++)
+      cpus_.push_back(cpu{i, i, 0, 0, true});
+
+    nodes_ = 1;
+  }
+};
+
+} // namespace parallel_f
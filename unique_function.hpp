@@ -0,0 +1,182 @@
+// === (C) 2020-2024 === parallel_f / unique_function (tasks, queues, lists in
+// parallel threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include "stats.hpp"
+
+namespace parallel_f {
+
+namespace details {
+
+/* heap allocations while scheduling, like callables not stored in place or
+ * new fibers, initialized up front, so it outlives the executors */
+inline std::shared_ptr<stats::counter> heap_allocs =
+    stats::instance::get().make_counter("alloc.heap");
+
+template <typename F> class is_std_function : public std::false_type {};
+
+template <typename S>
+class is_std_function<std::function<S>> : public std::true_type {};
+
+} // namespace details
+
+// parallel_f :: unique_function == implementation
+
+/*
+ * Move-only replacement for std::function on the scheduler's paths.
+ *
+ * Callables up to 'InlineSize' bytes (64 by default, e.g. a few shared_ptrs)
+ * are stored in place, larger ones on the heap, which is counted as
+ * 'alloc.heap' in the stats. Being move-only, it may hold move-only callables
+ * and is never copied. Calling an empty one throws std::bad_function_call.
+ */
+template <typename Signature, size_t InlineSize = 64> class unique_function;
+
+template <typename R, typename... Args, size_t InlineSize>
+class unique_function<R(Args...), InlineSize> {
+private:
+  class ops {
+  public:
+    R (*invoke)(void *storage, Args &&...args);
+    void (*move)(void *to, void *from); // destroys 'from'
+    void (*destroy)(void *storage);
+    const std::type_info &type;
+  };
+
+  template <typename F> static constexpr bool stored_inline() {
+    return sizeof(F) <= InlineSize &&
+           alignof(std::max_align_t) % alignof(F) == 0 &&
+           std::is_nothrow_move_constructible_v<F>;
+  }
+
+  template <typename F> class in_place {
+  public:
+    static R invoke(void *s, Args &&...args) {
+      return (*static_cast<F *>(s))(std::forward<Args>(args)...);
+    }
+
+    static void move(void *to, void *from) {
+      new (to) F(std::move(*static_cast<F *>(from)));
+
+      static_cast<F *>(from)->~F();
+    }
+
+    static void destroy(void *s) { static_cast<F *>(s)->~F(); }
+
+    static inline const ops table = {invoke, move, destroy, typeid(F)};
+  };
+
+  template <typename F> class on_heap {
+  public:
+    static R invoke(void *s, Args &&...args) {
+      return (**static_cast<F **>(s))(std::forward<Args>(args)...);
+    }
+
+    static void move(void *to, void *from) {
+      *static_cast<F **>(to) = *static_cast<F **>(from);
+    }
+
+    static void destroy(void *s) { delete *static_cast<F **>(s); }
+
+    static inline const ops table = {invoke, move, destroy, typeid(F)};
+  };
+
+  alignas(std::max_align_t) unsigned char storage[InlineSize];
+  const ops *table;
+
+public:
+  unique_function() : table(nullptr) {}
+
+  unique_function(std::nullptr_t) : table(nullptr) {}
+
+  template <typename Callable,
+            typename F = std::decay_t<Callable>,
+            typename = std::enable_if_t<
+                !std::is_same_v<F, unique_function> &&
+                std::is_invocable_r_v<R, F &, Args...>>>
+  unique_function(Callable &&callable) : table(nullptr) {
+    /* an empty std::function or null pointer makes an empty one */
+    if constexpr (std::is_pointer_v<F> || std::is_member_pointer_v<F> ||
+                  details::is_std_function<F>::value) {
+      if (!callable)
+        return;
+    }
+
+    if constexpr (stored_inline<F>()) {
+      new (storage) F(std::forward<Callable>(callable));
+
+      table = &in_place<F>::table;
+    } else {
+      details::heap_allocs->add();
+
+      new (storage) F *(new F(std::forward<Callable>(callable)));
+
+      table = &on_heap<F>::table;
+    }
+  }
+
+  unique_function(unique_function &&other) noexcept : table(other.table) {
+    if (table)
+      table->move(storage, other.storage);
+
+    other.table = nullptr;
+  }
+
+  unique_function &operator=(unique_function &&other) noexcept {
+    if (this != &other) {
+      reset();
+
+      table = other.table;
+
+      if (table)
+        table->move(storage, other.storage);
+
+      other.table = nullptr;
+    }
+
+    return *this;
+  }
+
+  unique_function &operator=(std::nullptr_t) {
+    reset();
+
+    return *this;
+  }
+
+  unique_function(const unique_function &) = delete;
+  unique_function &operator=(const unique_function &) = delete;
+
+  ~unique_function() { reset(); }
+
+  explicit operator bool() const { return table != nullptr; }
+
+  R operator()(Args... args) {
+    if (!table)
+      throw std::bad_function_call();
+
+    return table->invoke(storage, std::forward<Args>(args)...);
+  }
+
+  const std::type_info &target_type() const {
+    return table ? table->type : typeid(void);
+  }
+
+private:
+  void reset() {
+    if (table)
+      table->destroy(storage);
+
+    table = nullptr;
+  }
+};
+
+} // namespace parallel_f
@@ -3,150 +3,1690 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
 #include <functional>
-#include <map>
 #include <memory>
 #include <mutex>
 #include <queue>
-#include <stack>
 #include <string>
 #include <thread>
 
+#include "affinity.hpp"
+#include "budget.hpp"
+#include "cancel.hpp"
+#include "deque.hpp"
+#include "eventcount.hpp"
+#include "fiber.hpp"
+#include "job.hpp"
+#include "priority.hpp"
 #include "stats.hpp"
 #include "system.hpp"
+#include "topology.hpp"
+#include "unique_function.hpp"
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 
 namespace parallel_f {
 
 
-// parallel_f :: vthread == implementation
+namespace details {
+
+/*
+ * Calls to parallel_f::checkpoint() left until the next look at the clock. If the compiler
+ * keeps its address across a switch, a fiber may count on its previous thread's countdown
+ * until then, which only shifts the next check.
+ */
+inline thread_local int checkpoint_countdown = 0;
+
+}
+
+
+// parallel_f :: vthread == implementation
+
+class vthread : public std::enable_shared_from_this<vthread>
+{
+public:
+	/*
+	 * Pool of workers running vthreads, with its own queues and stats group.
+	 *
+	 * The default executor (instance()) is created on first use. Further executors
+	 * can be created to separate workloads, e.g. I/O bound from CPU bound tasks, or
+	 * to restrict a subsystem to some CPUs. Vthreads and tasks may depend on others
+	 * running on a different executor. An executor must outlive its vthreads.
+	 */
+	class executor
+	{
+		friend class vthread;
+
+	public:
+		enum class action
+		{
+			none,
+			exited,
+			suspended,
+			yielded
+		};
+
+	private:
+		/* one lane per priority, plus the EDF lane for vthreads with a deadline */
+		static constexpr unsigned int lane_count = priority_count + 1;
+		static constexpr unsigned int edf_lane = priority_count;
+
+		class worker
+		{
+		public:
+			class waits
+			{
+			public:
+				double total = 0.0;
+				float max = 0.0f;
+				unsigned int num = 0;
+			};
+
+			executor* owner;
+			unsigned int index;
+			topology::cpu cpu;
+			bool spare;				// compensating for blocked workers, see blocking
+			bool active;				// thread started and not retired, protected by spares_mutex
+			std::atomic<bool> exited;		// thread about to end after retiring, see grow()
+			bool stalled;				// detected as blocked by the monitor
+			uint64_t sampled;			// monitor's last look at 'dispatched'
+			std::atomic<uint64_t> dispatched;
+			std::atomic<bool> busy;
+			std::atomic<int> tid;
+			details::ws_deque<vthread> deques[priority_count];
+			details::ws_deque<details::job> jobs;	// see task_group
+			std::mutex mailbox_mutex;
+			std::deque<vthread*> mailbox;		// vthreads with an affinity to this worker, see schedule()
+			std::atomic<int> mailed;		// size of 'mailbox', read without the lock
+			waits waited[lane_count];		// reported in batches
+			std::shared_ptr<stats::stat> stat;
+			std::thread* thread;
+			unsigned int seed;
+			int64_t spin_ns;			// adaptive, up to executor::spin_max_ns
+			uint64_t slice_dispatched;		// 'dispatched' when the current slice began
+			int64_t slice;				// first checkpoint of the running vthread
+			int64_t checked;			// last checkpoint looking at the clock
+			int check_every;			// adaptive, up to checkpoint_max
+
+			details::fiber context;			// the worker thread's own stack
+			std::vector<details::fiber*> fibers;	// local cache of idle fibers
+			std::atomic<vthread*> next;		// successor to run right after the running vthread
+			bool handing_on;			// running vthread is starting successors before it exits, see handoff
+			unsigned int inlined;			// reported in batches
+			vthread* running;
+			std::shared_ptr<vthread> ref;		// reference to 'running'
+			action after;
+			unique_function<bool(std::shared_ptr<vthread>)> arm;
+
+			worker(executor* owner, unsigned int index, topology::cpu cpu, std::shared_ptr<stats::stat> stat, bool spare = false)
+				:
+				owner(owner),
+				index(index),
+				cpu(cpu),
+				spare(spare),
+				active(false),
+				exited(false),
+				stalled(false),
+				sampled(0),
+				dispatched(0),
+				busy(false),
+				tid(0),
+				mailed(0),
+				stat(stat),
+				thread(0),
+				seed(index * 2654435761u + 1),
+				spin_ns(spin_min_ns),
+				slice_dispatched(0),
+				slice(0),
+				checked(0),
+				check_every(1),
+				next(nullptr),
+				handing_on(false),
+				inlined(0),
+				running(0),
+				after(action::none)
+			{
+			}
+
+			unsigned int random()
+			{
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+
+				return seed;
+			}
+		};
+
+		/* injection queues and workers of one NUMA node */
+		class node
+		{
+		public:
+			details::inject_queue<vthread> injected[priority_count];
+			std::vector<worker*> workers;
+		};
+
+		static inline thread_local worker* current = nullptr;
+
+		static inline std::mutex config_mutex;
+		static inline std::unique_ptr<topology::config> config;
+		static inline bool created = false;
+
+		/* fibers migrate between threads, never let the compiler cache the TLS address across a switch */
+		static PARALLEL_F__NOINLINE worker* current_worker()
+		{
+			return current;
+		}
+
+		static constexpr size_t fiber_stack_size = 1024 * 1024;
+		static constexpr size_t fiber_cache_size = 16;
+		static constexpr unsigned int wait_report_batch = 64;
+		static constexpr int64_t spin_default_ns = 50000;
+		static constexpr int64_t spin_min_ns = 1000;
+		static constexpr int64_t quantum_default_ns = 2000000;
+		static constexpr int64_t retire_default_ns = 5000000000;
+		static constexpr int checkpoint_max = 4096;
+		static constexpr unsigned int affinity_bits = 12;
+		static constexpr int affinity_slack = 4;		// mailed vthreads before others may take them
+		static constexpr int64_t affinity_wait_ns = 1000000;	// or once the oldest waited that long
+
+		static int64_t clock_ns()
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+	private:
+		std::string name;
+		std::atomic<unsigned int> serial;		// numbers vthread names, see vthread::get_name()
+		details::eventcount idle;
+		std::vector<std::unique_ptr<node>> nodes;
+		std::vector<std::unique_ptr<worker>> workers;
+		bool pinned;
+		std::atomic<unsigned int> next_node;
+		std::atomic<int> queued[priority_count];	// not maintained for priority::normal
+		std::atomic<int64_t> served[priority_count];	// lane last served or seen without work
+		std::atomic<int64_t> aging_ns;
+		std::shared_ptr<stats::wait_stat> wait_stats[lane_count];
+		std::mutex edf_mutex;
+		std::vector<vthread*> edf;			// min-heap by deadline
+		std::atomic<int> edf_queued;
+		std::shared_ptr<stats::counter> deadlines_met;
+		std::shared_ptr<stats::counter> deadlines_missed;
+		std::atomic<int64_t> spin_max_ns;
+		std::atomic<int64_t> quantum_ns;
+		std::atomic<int64_t> retire_ns;
+		std::atomic<int> running;
+		std::atomic<bool> shutdown;
+		unsigned int workers_max;			// regular workers, started on demand
+		std::atomic<unsigned int> workers_active;	// regular workers started and not retired
+		std::mutex spares_mutex;			// also for starting and retiring regular workers
+		std::condition_variable spares_cond;
+		std::vector<worker*> spares;
+		unsigned int spares_active;
+		int blocked;					// workers within a blocking section
+		int stalled;					// workers found blocked by the monitor
+		int64_t detect_ns;
+		std::thread* monitor;
+		std::shared_ptr<stats::counter> compensations;
+		std::shared_ptr<stats::counter> inlined;
+		std::shared_ptr<stats::counter> preempted;
+		std::shared_ptr<stats::counter> started;
+		std::shared_ptr<stats::counter> retired;
+		std::unique_ptr<std::atomic<unsigned int>[]> affinities;	// hashed key to index + 1 of the worker running it last
+		std::shared_ptr<stats::counter> affine;
+		std::shared_ptr<stats::counter> unaffine;
+		std::mutex fibers_mutex;
+		std::vector<details::fiber*> fibers_free;
+		std::vector<std::unique_ptr<details::fiber>> fibers;
+		std::shared_ptr<stats::counter> fibers_made;
+
+	public:
+		/* the executor used unless given otherwise */
+		static executor& instance()
+		{
+			static executor default_instance("cpu", default_config());
+
+			return default_instance;
+		}
+
+		/* must be called before the default executor is used first */
+		static void configure(const topology::config& c)
+		{
+			std::unique_lock<std::mutex> lock(config_mutex);
+
+			if (created)
+				throw std::runtime_error("default executor already running");
+
+			config = std::make_unique<topology::config>(c);
+		}
+
+		static bool is_worker()
+		{
+			return current_worker() != nullptr;
+		}
+
+		/* the executor running the calling thread, nullptr if unmanaged */
+		static executor* current_executor()
+		{
+			worker* w = current_worker();
+
+			return w ? w->owner : nullptr;
+		}
+
+		static vthread* current_vthread()
+		{
+			worker* w = current_worker();
+
+			return w ? w->running : nullptr;
+		}
+
+	private:
+		static topology::config default_config()
+		{
+			std::unique_lock<std::mutex> lock(config_mutex);
+
+			created = true;
+
+			return config ? *config : topology::config::from_environment();
+		}
+
+	public:
+		/* 'name' is used as stats group, 'c' selects the CPUs to run workers on */
+		executor(std::string name, const topology::config& c = topology::config())
+			:
+			name(name),
+			serial(0),
+			pinned(false),
+			next_node(0),
+			aging_ns(50000000),
+			edf_queued(0),
+			spin_max_ns(spin_default_ns),
+			quantum_ns(quantum_default_ns),
+			retire_ns(retire_default_ns),
+			running(0),
+			shutdown(false),
+			workers_max(0),
+			workers_active(0),
+			spares_active(0),
+			blocked(0),
+			stalled(0),
+			detect_ns(0),
+			monitor(0),
+			affinities(new std::atomic<unsigned int>[1u << affinity_bits]())
+		{
+			const topology& topo = topology::get();
+
+			pinned = c.pin;
+
+			const char* spin = std::getenv("PARALLEL_F_SPIN_US");
+
+			if (spin)
+				spin_max_ns = std::atoll(spin) * 1000;
+
+			const char* idle_ms = std::getenv("PARALLEL_F_IDLE_MS");
+
+			if (idle_ms)
+				retire_ns = std::atoll(idle_ms) * 1000000;
+
+			for (unsigned int n = 0; n < topo.nodes(); n++)
+				nodes.push_back(std::make_unique<node>());
+
+			for (unsigned int p = 0; p < priority_count; p++) {
+				queued[p] = 0;
+				served[p] = clock_ns();
+
+				wait_stats[p] = stats::instance::get().make_wait_stat(name + "." + priority_name((priority)p));
+			}
+
+			wait_stats[edf_lane] = stats::instance::get().make_wait_stat(name + ".deadline");
+
+			deadlines_met = stats::instance::get().make_counter(name + ".deadline.met");
+			deadlines_missed = stats::instance::get().make_counter(name + ".deadline.missed");
+
+			compensations = stats::instance::get().make_counter(name + ".compensated");
+			inlined = stats::instance::get().make_counter(name + ".inlined");
+			preempted = stats::instance::get().make_counter(name + ".preempted");
+			started = stats::instance::get().make_counter(name + ".started");
+			retired = stats::instance::get().make_counter(name + ".retired");
+			affine = stats::instance::get().make_counter(name + ".affinity.kept");
+			unaffine = stats::instance::get().make_counter(name + ".affinity.moved");
+			fibers_made = stats::instance::get().make_counter(name + ".fibers");
+
+			std::vector<topology::cpu> cpus = topo.select(c);
+
+			/*
+			 * All workers are created upfront as they are looked up without locking, their threads
+			 * (and stats) only when needed, see wake() and compensate().
+			 */
+			for (auto& cpu : cpus) {
+				workers.push_back(std::make_unique<worker>(this, (unsigned int)workers.size(), cpu, nullptr));
+
+				nodes[cpu.node]->workers.push_back(workers.back().get());
+			}
+
+			workers_max = (unsigned int)cpus.size();
+
+			size_t num_spares = c.max_compensation < 0 ? cpus.size() : (size_t)c.max_compensation;
+
+			for (size_t i = 0; i < num_spares; i++) {
+				topology::cpu& cpu = cpus[i % cpus.size()];
+
+				workers.push_back(std::make_unique<worker>(this, (unsigned int)workers.size(), cpu, nullptr, true));
+
+				nodes[cpu.node]->workers.push_back(workers.back().get());
+
+				spares.push_back(workers.back().get());
+			}
+		}
+
+		~executor()
+		{
+			LOG_DEBUG("vthread::executor::~executor(): shutting down...\n");
+
+			std::unique_lock<std::mutex> lock(spares_mutex);
+
+			shutdown = true;
+
+			spares_cond.notify_all();
+
+			lock.unlock();
+
+			idle.notify_all();
+
+			for (auto& w : workers) {
+				if (!w->thread)
+					continue;
+
+				LOG_DEBUG("vthread::executor::~executor(): joining thread...\n");
+
+				w->thread->join();
+
+				delete w->thread;
+
+				/* workers hold a token while active, see grow() and compensate() */
+				if (w->active)
+					budget::instance().release();
+			}
+
+			if (monitor) {
+				monitor->join();
+
+				delete monitor;
+
+				budget::instance().release();
+			}
+		}
+
+		executor(const executor&) = delete;
+		executor& operator=(const executor&) = delete;
+
+		std::string get_name() const
+		{
+			return name;
+		}
+
+		size_t size() const
+		{
+			return workers.size();
+		}
+
+		/* workers parked for lack of work */
+		int parked() const
+		{
+			return idle.num_waiters();
+		}
+
+		/* regular workers currently running a thread, not counting spares */
+		unsigned int active() const
+		{
+			return workers_active.load(std::memory_order_relaxed);
+		}
+
+		/* period after which lower priority lanes are served even if higher ones have work */
+		void set_aging(std::chrono::nanoseconds aging)
+		{
+			aging_ns = aging.count();
+		}
+
+		/* maximum time an idle worker polls for work before parking */
+		void set_spin(std::chrono::nanoseconds spin)
+		{
+			spin_max_ns = spin.count();
+		}
+
+		/* time a vthread runs before parallel_f::checkpoint() gives way to more urgent work, zero never does */
+		void set_quantum(std::chrono::nanoseconds quantum)
+		{
+			quantum_ns = quantum.count();
+		}
+
+		/* time a worker stays parked without work before its thread ends, zero keeps workers */
+		void set_idle_timeout(std::chrono::nanoseconds timeout)
+		{
+			retire_ns = timeout.count();
+		}
+
+		/*
+		 * Enables a monitor thread treating workers as blocked, when they are sleeping in
+		 * the kernel (Linux) or just busy (elsewhere) with the same vthread for longer than
+		 * 'threshold'. Compensating workers are added for them like for blocking sections.
+		 */
+		void set_block_detection(std::chrono::nanoseconds threshold)
+		{
+			std::unique_lock<std::mutex> lock(spares_mutex);
+
+			detect_ns = threshold.count();
+
+			if (detect_ns > 0 && !monitor) {
+				budget::instance().acquire();
+
+				monitor = new std::thread([this]() { monitor_loop(); });
+			}
+
+			spares_cond.notify_all();
+		}
+
+		/*
+		 * Marks the running vthread 't' as about to exit while it exists, e.g. while starting the
+		 * successors of its finished task. The first one started meanwhile may take the worker's
+		 * next slot, see schedule(). Has no effect if 't' is not running on the calling worker.
+		 */
+		class handoff
+		{
+		private:
+			worker* w;
+
+		public:
+			handoff(vthread* t)
+				:
+				w(current_worker())
+			{
+				if (w && w->running == t && !w->handing_on)
+					w->handing_on = true;
+				else
+					w = nullptr;
+			}
+
+			~handoff()
+			{
+				if (w)
+					w->handing_on = false;
+			}
+
+			handoff(const handoff&) = delete;
+			handoff& operator=(const handoff&) = delete;
+		};
+
+		/* pushes to the calling worker's job deque, returns false if not called on a worker */
+		static bool push_job(details::job* j)
+		{
+			worker* w = current_worker();
+
+			if (!w)
+				return false;
+
+			w->jobs.push(j);
+
+			w->owner->wake();
+
+			return true;
+		}
+
+		/* a job of the calling worker (latest first) or stolen from another one, if any */
+		static details::job* take_job()
+		{
+			worker* w = current_worker();
+
+			if (!w)
+				return nullptr;
+
+			details::job* j = w->jobs.take();
+
+			return j ? j : w->owner->steal_job(w);
+		}
+
+		/* runs 'j' on a new vthread, for jobs from threads other than workers */
+		void start_job(details::job* j)
+		{
+			auto t = std::make_shared<vthread>("job", this);
+
+			t->set_priority(j->prio);
+			t->start([j]() { run_jobs(j); });
+		}
+
+		/* slow path of parallel_f::checkpoint(), on a vthread's fiber or an unmanaged thread */
+		static PARALLEL_F__NOINLINE void checkpoint()
+		{
+			worker* w = current_worker();
+
+			if (!w || !w->running) {
+				details::checkpoint_countdown = checkpoint_max;
+				return;
+			}
+
+			executor* e = w->owner;
+			int64_t now = clock_ns();
+			int64_t quantum = e->quantum_ns.load(std::memory_order_relaxed);
+			uint64_t dispatched = w->dispatched.load(std::memory_order_relaxed);
+
+			if (w->slice_dispatched != dispatched) {
+				w->slice_dispatched = dispatched;
+				w->slice = now;
+			} else {
+				/* look at the clock a few times per quantum */
+				int64_t elapsed = now - w->checked;
+
+				if (elapsed < quantum / 8 && w->check_every < checkpoint_max)
+					w->check_every *= 2;
+				else if (elapsed > quantum / 2 && w->check_every > 1)
+					w->check_every /= 2;
+			}
+
+			w->checked = now;
+
+			details::checkpoint_countdown = w->check_every;
+
+			if (!quantum || now - w->slice < quantum || !e->preempting(w, w->running))
+				return;
+
+			LOG_DEBUG("vthread::executor::checkpoint() yielding '%s'\n", w->running->get_name().c_str());
+
+			e->preempted->add();
+
+			/* resumed as a new slice, 'dispatched' changes */
+			suspend(action::yielded, nullptr);
+		}
+
+		/* used by parallel_f::blocking, returns the executor to call end_blocking() on */
+		static executor* begin_blocking()
+		{
+			worker* w = current_worker();
+
+			if (!w)
+				return nullptr;
+
+			executor* e = w->owner;
+
+			std::unique_lock<std::mutex> lock(e->spares_mutex);
+
+			e->blocked++;
+
+			/* the blocked worker's token goes to the compensating one */
+			budget::instance().release();
+
+			e->compensate();
+
+			return e;
+		}
+
+		void end_blocking()
+		{
+			std::unique_lock<std::mutex> lock(spares_mutex);
+
+			blocked--;
+
+			budget::instance().acquire();
+
+			/* let idle spares notice they are not needed anymore */
+			if (spares_active > needed())
+				idle.notify_all();
+		}
+
+	private:
+		unsigned int make_serial()
+		{
+			return serial.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		/* spares_mutex held */
+		unsigned int needed() const
+		{
+			int n = blocked + stalled;
+
+			return n < 0 ? 0 : std::min((unsigned int)n, (unsigned int)spares.size());
+		}
+
+		bool excess()
+		{
+			std::unique_lock<std::mutex> lock(spares_mutex);
+
+			return spares_active > needed() || shutdown;
+		}
+
+		/* spares_mutex held */
+		void compensate()
+		{
+			for (worker* w : spares) {
+				if (spares_active >= needed() || shutdown)
+					break;
+
+				if (w->active)
+					continue;
+
+				w->active = true;
+
+				spares_active++;
+
+				budget::instance().acquire();
+
+				compensations->add();
+
+				if (!w->thread)
+					launch(w);
+			}
+
+			spares_cond.notify_all();
+		}
+
+		/* spares_mutex held, creates the stats of workers started the first time */
+		void launch(worker* w)
+		{
+			if (!w->stat) {
+				std::string n = w->spare ? "spare" + std::to_string(w->index - workers_max) : std::to_string(w->cpu.id);
+
+				w->stat = stats::instance::get().make_stat(name + "." + n);
+			}
+
+			w->thread = new std::thread([this,w]() { loop(w); });
+		}
+
+		/* wakes a parked worker for new work, or starts another one if all of them are busy */
+		void wake()
+		{
+			idle.notify_one();
+
+			/* notify_one() fenced, pairs with retire_idle() */
+			unsigned int a = workers_active.load(std::memory_order_seq_cst);
+
+			if (a < workers_max && !idle.num_waiters() && running.load(std::memory_order_relaxed) >= (int)a &&
+			    (!a || budget::instance().in_use() < budget::instance().capacity()))
+				grow();
+		}
+
+		void grow()
+		{
+			std::unique_lock<std::mutex> lock(spares_mutex);
+
+			if (shutdown || workers_active >= workers_max)
+				return;
+
+			for (auto& w : workers) {
+				/* threads of retired workers may still be on their way out */
+				if (w->spare || w->active || (w->thread && !w->exited.load(std::memory_order_acquire)))
+					continue;
+
+				/* the first worker is needed in any case, further ones only within the CPU budget */
+				if (!workers_active)
+					budget::instance().acquire();
+				else if (!budget::instance().try_acquire())
+					return;
+
+				if (w->thread) {
+					w->thread->join();
+
+					delete w->thread;
+				}
+
+				w->active = true;
+				w->exited = false;
+
+				workers_active++;
+
+				started->add();
+
+				launch(w.get());
+				return;
+			}
+		}
+
+		/*
+		 * A regular worker idle for the retirement period lets its thread end, unless
+		 * work showed up meanwhile. Either wake() sees it gone and starts another one or
+		 * it sees the work, returns true if the worker retired.
+		 */
+		bool retire_idle(worker* w)
+		{
+			std::unique_lock<std::mutex> lock(spares_mutex);
+
+			if (shutdown)
+				return false;
+
+			w->active = false;
+
+			workers_active.fetch_sub(1, std::memory_order_seq_cst);
+
+			lock.unlock();
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+
+			if (!pending()) {
+				budget::instance().release();
+
+				report_waits(w);
+
+				retired->add();
+
+				LOG_DEBUG("vthread::executor::retire_idle(): worker %u retired\n", w->index);
+
+				/* the fibers stay with the executor */
+				std::unique_lock<std::mutex> fl(fibers_mutex);
+
+				fibers_free.insert(fibers_free.end(), w->fibers.begin(), w->fibers.end());
+
+				w->fibers.clear();
+
+				return true;
+			}
+
+			lock.lock();
+
+			w->active = true;
+
+			workers_active++;
+
+			return false;
+		}
+
+		/* whether any work is queued, anywhere */
+		bool pending()
+		{
+			if (edf_queued.load())
+				return true;
+
+			for (auto& n : nodes) {
+				for (unsigned int p = 0; p < priority_count; p++) {
+					if (!n->injected[p].empty())
+						return true;
+				}
+			}
+
+			for (auto& v : workers) {
+				if (v->next.load() || !v->jobs.empty() || v->mailed.load())
+					return true;
+
+				for (unsigned int p = 0; p < priority_count; p++) {
+					if (!v->deques[p].empty())
+						return true;
+				}
+			}
+
+			return false;
+		}
+
+		/* a spare not needed anymore hands over its local work and goes to sleep */
+		bool retire(worker* w)
+		{
+			std::unique_lock<std::mutex> lock(spares_mutex);
+
+			if (spares_active <= needed() && !shutdown)
+				return false;
+
+			w->active = false;
+
+			spares_active--;
+
+			budget::instance().release();
+
+			lock.unlock();
+
+			report_waits(w);
+
+			for (unsigned int p = 0; p < priority_count; p++) {
+				while (vthread* t = w->deques[p].take())
+					nodes[w->cpu.node]->injected[p].push(t);
+			}
+
+			idle.notify_all();
+
+			return true;
+		}
+
+		void monitor_loop()
+		{
+			std::unique_lock<std::mutex> lock(spares_mutex);
+
+			while (!shutdown) {
+				if (detect_ns <= 0) {
+					spares_cond.wait(lock);
+					continue;
+				}
+
+				spares_cond.wait_for(lock, std::chrono::nanoseconds(detect_ns));
+
+				for (auto& w : workers) {
+					uint64_t d = w->dispatched.load(std::memory_order_relaxed);
+					bool stuck = w->busy.load(std::memory_order_relaxed) && d == w->sampled && sleeping(w.get());
+
+					if (stuck != w->stalled) {
+						w->stalled = stuck;
+
+						stalled += stuck ? 1 : -1;
+					}
+
+					w->sampled = d;
+				}
+
+				compensate();
+
+				if (spares_active > needed())
+					idle.notify_all();
+			}
+		}
+
+		/* whether the worker's thread is waiting in the kernel */
+		static bool sleeping(worker* w)
+		{
+#ifdef __linux__
+			int tid = w->tid.load(std::memory_order_relaxed);
+
+			if (!tid)
+				return false;
+
+			std::ifstream f("/proc/self/task/" + std::to_string(tid) + "/stat");
+			std::string stat;
+
+			std::getline(f, stat);
+
+			/* the state follows the parenthesized command name */
+			size_t p = stat.rfind(')');
+
+			if (p == std::string::npos || p + 2 >= stat.size())
+				return false;
+
+			return stat[p + 2] == 'S' || stat[p + 2] == 'D';
+#else
+			(void)w;
+
+			return true;
+#endif
+		}
+
+		void loop(worker* w)
+		{
+			current = w;
+
+#ifdef __linux__
+			w->tid = (int)syscall(SYS_gettid);
+#endif
+
+			if (w->spare) {
+				loop_spare(w);
+				return;
+			}
+
+			if (pinned && !topology::pin(w->cpu.id))
+				LOG_INFO("vthread::executor::loop(): failed to pin worker %u to cpu %u\n", w->index, w->cpu.id);
+
+			w->context.convert_thread();
+
+			while (!shutdown && w->active)
+				once(w);
+
+			w->context.revert_thread();
+
+			current = nullptr;
+
+			w->exited.store(true, std::memory_order_release);
+		}
+
+		void loop_spare(worker* w)
+		{
+			w->context.convert_thread();
+
+			while (!shutdown) {
+				std::unique_lock<std::mutex> lock(spares_mutex);
+
+				while (!w->active && !shutdown)
+					spares_cond.wait(lock);
+
+				lock.unlock();
+
+				while (!shutdown) {
+					once(w);
+
+					if (retire(w))
+						break;
+				}
+			}
+
+			w->context.revert_thread();
+
+			current = nullptr;
+		}
+
+		void once(worker* w)
+		{
+			sysclock clock;
+
+			vthread* t = w->next.exchange(nullptr, std::memory_order_acquire);
+
+			if (t)
+				t = taken(w, t, clock_ns());
+			else
+				t = find(w);
+
+			if (!t)
+				t = spin(w);
+
+			if (!t) {
+				report_waits(w);
+
+				/* spares should rather retire than park */
+				if (w->spare && excess())
+					return;
+
+				uint32_t key = idle.prepare_wait();
+
+				/* re-check after announcing ourself, schedule() notifies after publishing */
+				t = find(w);
+
+				if (t || shutdown)
+					idle.cancel_wait();
+				else {
+					int64_t timeout = w->spare ? 0 : retire_ns.load(std::memory_order_relaxed);
+					bool woken = true;
+
+					if (timeout > 0)
+						woken = idle.wait_for(key, timeout);
+					else
+						idle.wait(key);
+
+					t = find(w);
+
+					if (!t && !woken && retire_idle(w))
+						return;
+				}
+			}
+
+			if (w->stat)
+				w->stat->report_idle(clock.reset());
+
+			if (!t)
+				return;
+
+			std::shared_ptr<vthread> ref = std::move(t->scheduled);
+
+			int r = ++running;
+
+			LOG_DEBUG("vthread::executor::once(): running: %d, priority: %s\n", r, priority_name(ref->prio));
+
+			execute(w, std::move(ref));
+
+			running--;
+
+			if (w->stat)
+				w->stat->report_busy(clock.reset());
+		}
+
+		/* node last run on or preferred, then the caller's node, then round robin */
+		unsigned int home(vthread* t, worker* w)
+		{
+			int n = t->node.load(std::memory_order_relaxed);
+
+			if (n >= 0 && (unsigned int)n < nodes.size())
+				return n;
+
+			if (w)
+				return w->cpu.node;
+
+			return next_node++ % nodes.size();
+		}
+
+		/*
+		 * Polls for work before parking. The budget doubles whenever spinning paid off
+		 * and halves when it did not, so workers of sparse workloads go to sleep quickly.
+		 */
+		vthread* spin(worker* w)
+		{
+			int64_t max = spin_max_ns.load(std::memory_order_relaxed);
+
+			if (w->spin_ns > max)
+				w->spin_ns = max;
+
+			if (w->spin_ns <= 0) {
+				/* probe now and then, otherwise we would never spin again */
+				if (max > 0 && (w->random() & 15) == 0)
+					w->spin_ns = spin_min_ns;
+
+				return nullptr;
+			}
+
+			int64_t deadline = clock_ns() + w->spin_ns;
+
+			do {
+				for (int i = 0; i < 64; i++)
+					PARALLEL_F__CPU_RELAX();
+
+				vthread* t = find(w);
+
+				if (t) {
+					w->spin_ns = std::min(max, std::max(spin_min_ns, w->spin_ns * 2));
+
+					return t;
+				}
+
+				if (shutdown)
+					break;
+			} while (clock_ns() < deadline);
+
+			w->spin_ns /= 2;
+
+			if (w->spin_ns < spin_min_ns)
+				w->spin_ns = 0;
+
+			return nullptr;
+		}
+
+		void schedule(std::shared_ptr<vthread> thread, bool yielded = false)
+		{
+			vthread* t = thread.get();
+			worker* w = current_worker();
+			unsigned int lane = t->deadline ? edf_lane : (unsigned int)t->prio;
+
+			t->scheduled = std::move(thread);
+			t->enqueued = clock_ns();
+			t->lane = lane;
+
+			if (lane == edf_lane) {
+				std::unique_lock<std::mutex> lock(edf_mutex);
+
+				edf.push_back(t);
+
+				std::push_heap(edf.begin(), edf.end(), later);
+
+				edf_queued++;
+
+				lock.unlock();
+
+				wake();
+				return;
+			}
+
+			if (t->prio != priority::normal)
+				queued[lane]++;
+
+			/* back to the worker which ran the same key last, unless that's us anyway */
+			if (t->affinity && lane == (unsigned int)priority::normal && !yielded) {
+				worker* v = affine_worker(t->affinity);
+
+				if (v && v != w) {
+					std::unique_lock<std::mutex> lock(v->mailbox_mutex);
+
+					v->mailbox.push_back(t);
+					v->mailed.fetch_add(1, std::memory_order_release);
+
+					lock.unlock();
+
+					wake();
+					return;
+				}
+			}
+
+			/*
+			 * A vthread started by one about to exit (e.g. the successor of a finishing task, see
+			 * handoff) takes the worker's next slot, unless it is less urgent or the slot is taken.
+			 * Nobody is woken for it, the worker runs it right away. Others started by a running
+			 * vthread are published, it may keep the worker busy for long.
+			 */
+			if (w && w->owner == this && w->handing_on && !yielded && !t->fiber && t->prio <= w->running->prio &&
+			    !w->next.load(std::memory_order_relaxed))
+			{
+				w->next.store(t, std::memory_order_release);
+				return;
+			}
+
+			if (w && w->owner == this && !yielded)
+				w->deques[lane].push(t);
+			else
+				nodes[home(t, w)]->injected[lane].push(t);
+
+			/* wakes one parked worker, if any, spinning ones find the work on their own */
+			wake();
+		}
+
+		/* called on a vthread's fiber, returns when it got resumed (possibly on another worker) */
+		static void suspend(action after, unique_function<bool(std::shared_ptr<vthread>)> arm)
+		{
+			worker* w = current_worker();
+			vthread* t = w->running;
+
+			w->after = after;
+			w->arm = std::move(arm);
+
+			t->fiber->switch_to(w->context);
+		}
+
+	private:
+		static void fiber_main(void*)
+		{
+			for (;;) {
+				worker* w = current_worker();
+				vthread* t = w->running;
+
+				t->run();
+
+				w = current_worker();
+
+				/* continue with the successor right here, saving the switches and keeping its data hot */
+				vthread* n = w->next.exchange(nullptr, std::memory_order_acquire);
+
+				if (n) {
+					w->owner->run_inline(w, t, n);
+					continue;
+				}
+
+				w->after = action::exited;
+
+				t->fiber->switch_to(w->context);
+			}
+		}
+
+		/* on the fiber of 't' which has exited, hands the fiber over to 'n' */
+		void run_inline(worker* w, vthread* t, vthread* n)
+		{
+			int64_t now = clock_ns();
+
+			if (t->deadline)
+				(now > t->deadline ? deadlines_missed : deadlines_met)->add();
+
+			n->fiber = t->fiber;
+			t->fiber = 0;
+
+			taken(w, n, now);
+
+			w->running = n;
+			w->inlined++;
+
+			/* counts the vthread, its time is accounted to the one it was inlined into */
+			if (w->stat)
+				w->stat->report_busy(0.0f);
+
+			w->dispatched.fetch_add(1, std::memory_order_relaxed);
+
+			n->node.store(w->cpu.node, std::memory_order_relaxed);
+
+			if (n->affinity)
+				remember(n->affinity, w);
+
+			/* releases 't' */
+			w->ref = std::move(n->scheduled);
+		}
+
+		void execute(worker* w, std::shared_ptr<vthread> ref)
+		{
+			vthread* t = ref.get();
+
+			if (!t->fiber)
+				t->fiber = acquire_fiber(w);
+
+			w->running = t;
+			w->ref = std::move(ref);
+			w->after = action::none;
+
+			w->dispatched.fetch_add(1, std::memory_order_relaxed);
+			w->busy.store(true, std::memory_order_relaxed);
+
+			t->node.store(w->cpu.node, std::memory_order_relaxed);
+
+			if (t->affinity)
+				remember(t->affinity, w);
 
-class vthread : public std::enable_shared_from_this<vthread>
-{
-private:
-	class manager
-	{
-	private:
-		std::map<std::string, unsigned int> names;
-		std::mutex mutex;
-		std::condition_variable cond;
-		std::stack<std::shared_ptr<vthread>> stack;
-		std::vector<std::thread*> threads;
-		int running;
-		bool shutdown;
+			w->context.switch_to(*t->fiber);
 
-	public:
-		static manager& instance()
+			/* back on the worker's own stack, the fiber is not running anymore, it may run another vthread by now */
+			t = w->running;
+			ref = std::move(w->ref);
+
+			w->running = 0;
+
+			w->busy.store(false, std::memory_order_relaxed);
+
+			switch (w->after) {
+				case action::exited:
+					if (t->deadline)
+						(clock_ns() > t->deadline ? deadlines_missed : deadlines_met)->add();
+
+					release_fiber(w, t->fiber);
+
+					t->fiber = 0;
+					break;
+
+				case action::suspended: {
+					auto arm = std::move(w->arm);
+
+					/* arm() registers the vthread for resumption, false means its condition is already met */
+					if (!arm(ref))
+						schedule(std::move(ref));
+					break;
+				}
+
+				case action::yielded:
+					schedule(std::move(ref), true);
+					break;
+
+				case action::none:
+					throw std::runtime_error("vthread fiber switched back without action");
+			}
+		}
+
+		details::fiber* acquire_fiber(worker* w)
 		{
-			static manager manager_instance;
+			if (!w->fibers.empty()) {
+				details::fiber* f = w->fibers.back();
+
+				w->fibers.pop_back();
+
+				return f;
+			}
+
+			std::unique_lock<std::mutex> lock(fibers_mutex);
+
+			if (!fibers_free.empty()) {
+				details::fiber* f = fibers_free.back();
 
-			return manager_instance;
+				fibers_free.pop_back();
+
+				return f;
+			}
+
+			details::heap_allocs->add();
+			fibers_made->add();
+
+			fibers.push_back(std::make_unique<details::fiber>(fiber_stack_size, fiber_main, nullptr));
+
+			return fibers.back().get();
 		}
 
-	public:
-		manager()
-			:
-			running(0),
-			shutdown(false)
+		void release_fiber(worker* w, details::fiber* f)
 		{
-			for (unsigned int i = 0; i < std::thread::hardware_concurrency(); i++) {
-				auto stat = stats::instance::get().make_stat(std::string("cpu.") + std::to_string(i));
+			if (w->fibers.size() < fiber_cache_size) {
+				w->fibers.push_back(f);
+				return;
+			}
+
+			std::unique_lock<std::mutex> lock(fibers_mutex);
+
+			fibers_free.push_back(f);
+		}
+
+		static bool later(const vthread* a, const vthread* b)
+		{
+			return a->deadline > b->deadline;
+		}
+
+		vthread* find_edf()
+		{
+			std::unique_lock<std::mutex> lock(edf_mutex);
+
+			if (edf.empty())
+				return nullptr;
+
+			std::pop_heap(edf.begin(), edf.end(), later);
+
+			vthread* t = edf.back();
+
+			edf.pop_back();
+
+			edf_queued--;
+
+			return t;
+		}
+
+		/* whether more urgent work than 't' is waiting, in the order find() serves lanes */
+		bool preempting(worker* w, vthread* t)
+		{
+			unsigned int lane = t->lane;
+
+			if (lane == (unsigned int)priority::realtime)
+				return false;
+
+			if (queued[(unsigned int)priority::realtime].load(std::memory_order_relaxed))
+				return true;
+
+			/*
+			 * A successor in our next slot is not counted in 'queued'. It is at least as urgent as
+			 * 't' which started it and it waits for 't' to exit, so give way to it.
+			 */
+			if (w->next.load(std::memory_order_relaxed))
+				return true;
+
+			if (lane == edf_lane)
+				return false;
+
+			if (edf_queued.load(std::memory_order_relaxed))
+				return true;
 
-				threads.push_back(new std::thread([this,stat]() { loop(stat); }));
+			if (lane == (unsigned int)priority::normal)
+				return false;
+
+			/* not counted for normal priority, look at the queues */
+			unsigned int normal = (unsigned int)priority::normal;
+
+			if (!w->deques[normal].empty() || w->mailed.load(std::memory_order_relaxed))
+				return true;
+
+			for (auto& n : nodes) {
+				if (!n->injected[normal].empty())
+					return true;
 			}
+
+			for (auto& v : workers) {
+				if (!v->deques[normal].empty())
+					return true;
+			}
+
+			return false;
 		}
 
-		~manager()
+		/*
+		 * Strict priority, except for lower lanes not served within the aging period.
+		 * Vthreads with a deadline are served earliest deadline first, after realtime
+		 * and before normal priority work.
+		 */
+		vthread* find(worker* w)
 		{
-			LOG_DEBUG("vthread::manager::~manager(): shutting down...\n");
+			int64_t now = clock_ns();
+			int64_t aging = aging_ns.load(std::memory_order_relaxed);
 
-			std::unique_lock<std::mutex> lock(mutex);
+			for (unsigned int p = (unsigned int)priority::normal; p < priority_count; p++) {
+				if (now - served[p].load(std::memory_order_relaxed) < aging)
+					continue;
 
-			shutdown = true;
+				vthread* t = (p == (unsigned int)priority::normal || queued[p]) ? find(w, p) : nullptr;
 
-			cond.notify_all();
+				if (t)
+					return taken(w, t, now);
 
-			lock.unlock();
+				served[p].store(now, std::memory_order_relaxed);
+			}
+
+			for (unsigned int p = 0; p < priority_count; p++) {
+				if (p == (unsigned int)priority::normal && edf_queued.load(std::memory_order_relaxed)) {
+					vthread* t = find_edf();
+
+					if (t)
+						return taken(w, t, now);
+				}
+
+				if (p != (unsigned int)priority::normal && !queued[p])
+					continue;
+
+				vthread* t = find(w, p);
 
-			for (auto t : threads) {
-				LOG_DEBUG("vthread::manager::~manager(): joining thread...\n");
+				if (t)
+					return taken(w, t, now);
+			}
+
+			/* last resort, successors waiting for a busy worker */
+			size_t n = workers.size();
+			size_t r = w->random();
+
+			for (size_t i = 0; i < n; i++) {
+				worker* victim = workers[(r + i) % n].get();
+
+				if (victim == w || !victim->next.load(std::memory_order_relaxed))
+					continue;
 
-				t->join();
+				vthread* t = victim->next.exchange(nullptr, std::memory_order_acquire);
 
-				delete t;
+				if (t)
+					return taken(w, t, now);
 			}
+
+			/* jobs come last, a vthread is only made for running them when taken */
+			details::job* j = w->jobs.take();
+
+			if (!j)
+				j = steal_job(w);
+
+			if (j)
+				return job_vthread(j);
+
+			return nullptr;
 		}
 
-		std::string make_name(std::string name)
+		vthread* job_vthread(details::job* j)
 		{
-			return name + "." + std::to_string(names[name]++);
+			auto ref = std::make_shared<vthread>("job", this);
+			vthread* t = ref.get();
+
+			t->prio = j->prio;
+			t->lane = (unsigned int)j->prio;
+			t->started = true;
+			t->func = [j]() { run_jobs(j); };
+			t->scheduled = std::move(ref);
+
+			return t;
 		}
 
-		void loop(std::shared_ptr<stats::stat> stat)
+		/* keeps going with further jobs, the vthread is the expensive part */
+		static void run_jobs(details::job* j)
 		{
-			while (!shutdown)
-				once(stat);
+			do {
+				j->run();
+
+				if (--details::checkpoint_countdown <= 0)
+					checkpoint();
+			} while ((j = take_job()));
 		}
 
-		void once( std::shared_ptr<stats::stat> stat, unsigned int timeout_ms = 100 )
+		details::job* steal_job(worker* w)
 		{
-			sysclock clock;
-			std::unique_lock<std::mutex> lock(mutex);
+			size_t n = workers.size();
+			size_t r = w->random();
 
-			if (stack.empty())
-				cond.wait_for(lock, std::chrono::milliseconds(timeout_ms));
+			for (size_t i = 0; i < n; i++) {
+				worker* victim = workers[(r + i) % n].get();
 
-			if (stat)
-				stat->report_idle(clock.reset());
+				if (victim == w)
+					continue;
 
-			if (shutdown || stack.empty())
-				return;
+				details::job* j = victim->jobs.steal();
+
+				if (j)
+					return j;
+			}
+
+			return nullptr;
+		}
 
-			std::shared_ptr<vthread> t = stack.top();
+		/* mailbox, local deque, then our node, then remote nodes */
+		vthread* find(worker* w, unsigned int lane)
+		{
+			vthread* t = lane == (unsigned int)priority::normal ? unmail(w, w) : nullptr;
 
-			stack.pop();
+			if (t)
+				return t;
 
-			running++;
+			t = w->deques[lane].take();
 
-			LOG_DEBUG("vthread::manager::once(): running: %d, stack: %zu\n", running, stack.size());
+			if (t)
+				return t;
 
-			lock.unlock();
+			size_t n = nodes.size();
 
-			t->run();
+			for (size_t i = 0; i < n; i++) {
+				node* nd = nodes[(w->cpu.node + i) % n].get();
 
-			lock.lock();
+				t = take_injected(w, nd, lane);
 
-			running--;
+				if (t)
+					return t;
+
+				t = steal(w, nd, lane);
+
+				if (t)
+					return t;
+			}
 
-			if (stat)
-				stat->report_busy(clock.reset());
+			return nullptr;
 		}
 
-		void schedule(std::shared_ptr<vthread> thread)
+		vthread* take_injected(worker* w, node* nd, unsigned int lane)
 		{
-			std::unique_lock<std::mutex> lock(mutex);
+			vthread* t = nd->injected[lane].take_all();
 
-			stack.push(thread);
+			if (t) {
+				/* keep the oldest, publish the rest for stealing */
+				for (vthread* n = t->inject_next; n; n = n->inject_next)
+					w->deques[lane].push(n);
+			}
 
-			cond.notify_one();
+			return t;
 		}
 
-		bool has_thread(std::thread::id tid)
+		vthread* taken(worker* w, vthread* t, int64_t now)
 		{
-			for (auto t : threads) {
-				if (t->get_id() == tid)
-					return true;
+			unsigned int lane = t->lane;
+
+			if (lane != edf_lane) {
+				if (lane != (unsigned int)priority::normal)
+					queued[lane]--;
+
+				/* avoid writing the shared timestamp on every pick */
+				if (now - served[lane].load(std::memory_order_relaxed) > aging_ns.load(std::memory_order_relaxed) / 8)
+					served[lane].store(now, std::memory_order_relaxed);
 			}
 
-			return false;
+			float wait = (now - t->enqueued) / 1000000000.0f;
+
+			worker::waits& waited = w->waited[lane];
+
+			waited.total += wait;
+			waited.num++;
+
+			if (waited.max < wait)
+				waited.max = wait;
+
+			if (waited.num >= wait_report_batch)
+				report_waits(w);
+
+			return t;
+		}
+
+		void report_waits(worker* w)
+		{
+			if (w->inlined) {
+				inlined->add(w->inlined);
+
+				w->inlined = 0;
+			}
+
+			for (unsigned int p = 0; p < lane_count; p++) {
+				worker::waits& waited = w->waited[p];
+
+				if (!waited.num)
+					continue;
+
+				wait_stats[p]->report_wait(waited.total, waited.max, waited.num);
+
+				waited = worker::waits();
+			}
+		}
+
+		vthread* steal(worker* w, node* nd, unsigned int lane)
+		{
+			size_t n = nd->workers.size();
+
+			if (!n)
+				return nullptr;
+
+			size_t r = w->random();
+
+			for (size_t i = 0; i < n; i++) {
+				worker* victim = nd->workers[(r + i) % n];
+
+				if (victim == w)
+					continue;
+
+				vthread* t = victim->deques[lane].steal();
+
+				if (t)
+					return t;
+
+				if (lane == (unsigned int)priority::normal && victim->mailed.load(std::memory_order_relaxed)) {
+					t = unmail(w, victim);
+
+					if (t)
+						return t;
+				}
+			}
+
+			return nullptr;
+		}
+
+		static size_t affinity_slot(uint64_t key)
+		{
+			return (size_t)((key * 0x9e3779b97f4a7c15ull) >> (64 - affinity_bits));
+		}
+
+		/* regular worker which ran 'key' last, if any */
+		worker* affine_worker(uint64_t key)
+		{
+			unsigned int i = affinities[affinity_slot(key)].load(std::memory_order_relaxed);
+
+			return i ? workers[i - 1].get() : nullptr;
+		}
+
+		void remember(uint64_t key, worker* w)
+		{
+			/* spares come and go */
+			if (w->spare)
+				return;
+
+			std::atomic<unsigned int>& slot = affinities[affinity_slot(key)];
+
+			if (slot.load(std::memory_order_relaxed) != w->index + 1)
+				slot.store(w->index + 1, std::memory_order_relaxed);
+		}
+
+		/*
+		 * Oldest vthread mailed to 'v', taken by 'w'. Others only take it if 'v' is idle,
+		 * has more than a few mailed or the oldest waited too long.
+		 */
+		vthread* unmail(worker* w, worker* v)
+		{
+			if (!v->mailed.load(std::memory_order_acquire))
+				return nullptr;
+
+			std::unique_lock<std::mutex> lock(v->mailbox_mutex);
+
+			if (v->mailbox.empty())
+				return nullptr;
+
+			vthread* t = v->mailbox.front();
+
+			if (w != v && v->busy.load(std::memory_order_relaxed) && (int)v->mailbox.size() <= affinity_slack &&
+			    clock_ns() - t->enqueued < affinity_wait_ns)
+				return nullptr;
+
+			v->mailbox.pop_front();
+			v->mailed.fetch_sub(1, std::memory_order_relaxed);
+
+			lock.unlock();
+
+			(w == v ? affine : unaffine)->add();
+
+			return t;
 		}
 	};
 
 public:
 	static bool is_managed_thread()
 	{
-		return manager::instance().has_thread(std::this_thread::get_id());
+		return executor::is_worker();
 	}
 
 	static void yield()
@@ -156,7 +1696,7 @@ public:
 		if (!is_managed_thread())
 			throw std::runtime_error("not a managed thread");
 
-		manager::instance().once(0, 10);
+		executor::suspend(executor::action::yielded, nullptr);
 	}
 
 	static void wait(std::condition_variable &cond, std::unique_lock<std::mutex> &lock)
@@ -169,44 +1709,143 @@ public:
 		cond.wait(lock);
 	}
 
-private:
-	std::string name;
-	std::function<void(void)> func;
-	bool done;
+	/*
+	 * Suspends the calling vthread, parking its fiber without blocking the worker.
+	 *
+	 * After switching away, 'arm' is called with a reference to the suspended vthread
+	 * and has to hand it to whoever calls resume() later on. If 'arm' returns false
+	 * the vthread is resumed right away, e.g. when the awaited condition is met already.
+	 */
+	static void suspend(unique_function<bool(std::shared_ptr<vthread>)> arm)
+	{
+		LOG_DEBUG("vthread::suspend()...\n");
+
+		if (!is_managed_thread())
+			throw std::runtime_error("not a managed thread");
+
+		executor::suspend(executor::action::suspended, std::move(arm));
+	}
+
+	/*
+	 * Selects the CPUs to run workers on and whether to pin them, see topology::config.
+	 * Has to be called before the first vthread is created, otherwise PARALLEL_F_CPUS
+	 * and PARALLEL_F_PIN from the environment are used.
+	 */
+	static void configure(const topology::config& config)
+	{
+		executor::configure(config);
+	}
+
+	/*
+	 * Maximum time an idle worker polls for work before parking, trading CPU for wakeup
+	 * latency. Defaults to 50 us or PARALLEL_F_SPIN_US from the environment, zero parks
+	 * right away.
+	 */
+	static void set_spin(std::chrono::nanoseconds spin)
+	{
+		executor::instance().set_spin(spin);
+	}
+
+	/* period after which lower priority lanes are served even if higher ones have work */
+	static void set_aging(std::chrono::nanoseconds aging)
+	{
+		executor::instance().set_aging(aging);
+	}
+
+	/* time a vthread runs before parallel_f::checkpoint() yields it to more urgent work, 2 ms by default */
+	static void set_quantum(std::chrono::nanoseconds quantum)
+	{
+		executor::instance().set_quantum(quantum);
+	}
+
+	/*
+	 * Time a worker stays parked without work before its thread ends, it is started again
+	 * when needed. Defaults to 5 s or PARALLEL_F_IDLE_MS from the environment, zero keeps
+	 * started workers.
+	 */
+	static void set_idle_timeout(std::chrono::nanoseconds timeout)
+	{
+		executor::instance().set_idle_timeout(timeout);
+	}
+
+	static void resume(std::shared_ptr<vthread> thread)
+	{
+		LOG_DEBUG("vthread::resume(%p '%s')\n", thread.get(), thread->get_name().c_str());
+
+		executor* e = thread->exec;
+
+		e->schedule(std::move(thread));
+	}
+
+protected:
+	/* also guarding the state of derived classes, e.g. task_node, waiters recheck their own condition */
 	std::mutex mutex;
 	std::condition_variable cond;
+	std::vector<std::shared_ptr<vthread>> joiners;
+
+private:
+	executor* exec;
+	const char* name;				// static string without the serial, formatted by get_name() only
+	unsigned int serial;
+	unique_function<void(void)> func;
+	bool started;
+	bool done;
 	std::thread::id thread_id;
 	std::thread* unmanaged;
+	std::shared_ptr<vthread> scheduled;	// reference held while queued
+	vthread* inject_next;
+	details::fiber* fiber;
+	priority prio;
+	int64_t deadline;				// steady clock in ns, zero for none
+	unsigned int lane;				// lane queued on
+	int64_t enqueued;
+	std::atomic<int> node;			// NUMA node index last run on or preferred, -1 if none
+	uint64_t affinity;				// key to run close to, zero for none
+	cancel_token token;
+
+	friend class details::inject_queue<vthread>;
 
 public:
-	vthread(std::string name = "unnamed")
+	/* 'name' has to be static, e.g. a string literal */
+	vthread(const char* name = "unnamed", executor* exec = nullptr)
 		:
-		name(manager::instance().make_name(name)),
+		exec(exec ? exec : &executor::instance()),
+		name(name),
+		serial(this->exec->make_serial()),
+		started(false),
 		done(false),
-		unmanaged(0)
+		unmanaged(0),
+		inject_next(0),
+		fiber(0),
+		prio(priority::normal),
+		deadline(0),
+		lane(0),
+		enqueued(0),
+		node(-1),
+		affinity(0)
 	{
-		LOG_DEBUG("vthread::vthread(%p, '%s')\n", this, name.c_str());
+		LOG_DEBUG("vthread::vthread(%p, '%s')\n", this, get_name().c_str());
 	}
 
 	virtual ~vthread()
 	{
-		LOG_DEBUG("vthread::~vthread(%p '%s')...\n", this, name.c_str());
+		LOG_DEBUG("vthread::~vthread(%p '%s')...\n", this, get_name().c_str());
 
 		std::unique_lock<std::mutex> lock(mutex);
 
-		if (func) {	// thread had been started?
-			LOG_DEBUG("vthread::~vthread(%p '%s') thread was started\n", this, name.c_str());
+		if (started) {
+			LOG_DEBUG("vthread::~vthread(%p '%s') thread was started\n", this, get_name().c_str());
 
-			while (!done) {
-				if (vthread::is_managed_thread())
-					LOG_ERROR("~vthread while running\n");
+			if (!done && vthread::is_managed_thread())
+				LOG_ERROR("~vthread while running\n");
 
-				LOG_DEBUG("vthread::~vthread(%p '%s') waiting for run() to finish\n", this, name.c_str());
+			while (!done) {
+				LOG_DEBUG("vthread::~vthread(%p '%s') waiting for run() to finish\n", this, get_name().c_str());
 
 				vthread::wait(cond, lock);
 			}
 
-			LOG_DEBUG("vthread::~vthread(%p '%s') thread is done\n", this, name.c_str());
+			LOG_DEBUG("vthread::~vthread(%p '%s') thread is done\n", this, get_name().c_str());
 		}
 
 		if (unmanaged) {
@@ -216,21 +1855,23 @@ public:
 	}
 
 public:
-	void start(std::function<void(void)> f, bool managed = true)  // TODO: remove 'unmanaged' feature
+	void start(unique_function<void(void)> f, bool managed = true)  // TODO: remove 'unmanaged' feature
 	{
-		LOG_DEBUG("vthread::start(%p '%s', %s)...\n", this, name.c_str(), f.target_type().name());
+		LOG_DEBUG("vthread::start(%p '%s', %s)...\n", this, get_name().c_str(), f.target_type().name());
 
 		std::unique_lock<std::mutex> lock(mutex);
 
-		if (func)
+		if (started)
 			throw std::runtime_error("vthread::start called again");
 
-		func = f;
+		started = true;
+
+		func = std::move(f);
 
 		auto shared_this = shared_from_this();
 
 		if (managed) {
-			manager::instance().schedule(shared_this);
+			exec->schedule(std::move(shared_this));
 		}
 		else {
 			unmanaged = new std::thread([shared_this]() {
@@ -241,22 +1882,25 @@ public:
 
 	void run()
 	{
-		LOG_DEBUG("vthread::run(%p '%s')...\n", this, name.c_str());
+		LOG_DEBUG("vthread::run(%p '%s')...\n", this, get_name().c_str());
 
 		std::unique_lock<std::mutex> lock(mutex);
 
 		thread_id = std::this_thread::get_id();
 
-		std::function<void(void)> f = func;
+		/* moved out, captures are released when done instead of staying with the vthread */
+		unique_function<void(void)> f = std::move(func);
 
 		lock.unlock();
 
-		LOG_DEBUG("vthread::run(%p '%s') calling %s...\n", this, name.c_str(), f.target_type().name());
+		LOG_DEBUG("vthread::run(%p '%s') calling %s...\n", this, get_name().c_str(), f.target_type().name());
 
 		if (f)
 			f();
 
-		LOG_DEBUG("vthread::run(%p '%s') calling %s done.\n", this, name.c_str(), f.target_type().name());
+		LOG_DEBUG("vthread::run(%p '%s') calling %s done.\n", this, get_name().c_str(), f.target_type().name());
+
+		f = nullptr;
 
 		lock.lock();
 
@@ -266,23 +1910,39 @@ public:
 
 		thread_id = std::thread::id();
 
-		LOG_DEBUG("vthread::run(%p '%s') done.\n", this, name.c_str());
+		std::vector<std::shared_ptr<vthread>> j = std::move(joiners);
+
+		lock.unlock();
+
+		for (auto& t : j)
+			resume(t);
+
+		LOG_DEBUG("vthread::run(%p '%s') done.\n", this, get_name().c_str());
 	}
 
 	void join()
 	{
-		LOG_DEBUG("vthread::join(%p '%s')...\n", this, name.c_str());
+		LOG_DEBUG("vthread::join(%p '%s')...\n", this, get_name().c_str());
 
 		std::unique_lock<std::mutex> lock(mutex);
 
 		while (!done) {
 			if (vthread::is_managed_thread()) {
-				if (thread_id == std::this_thread::get_id())
+				if (executor::current_vthread() == this)
 					throw std::runtime_error("calling join on ourself");
 
 				lock.unlock();
 
-				vthread::yield();	// TODO: implement condition_variable support
+				vthread::suspend([this](std::shared_ptr<vthread> self) {
+					std::unique_lock<std::mutex> lock(mutex);
+
+					if (done)
+						return false;
+
+					joiners.push_back(self);
+
+					return true;
+				});
 
 				lock.lock();
 			}
@@ -291,15 +1951,142 @@ public:
 		}
 	}
 
+	/* applies to the next time the vthread gets scheduled */
+	void set_priority(priority p)
+	{
+		prio = p;
+	}
+
+	priority get_priority() const
+	{
+		return prio;
+	}
+
+	executor* get_executor() const
+	{
+		return exec;
+	}
+
+	/* applies to the next time the vthread gets scheduled, making it run earliest deadline first */
+	void set_deadline(std::chrono::steady_clock::time_point d)
+	{
+		deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(d.time_since_epoch()).count();
+	}
+
+	void clear_deadline()
+	{
+		deadline = 0;
+	}
+
+	/* hint for the NUMA node to queue the vthread on when scheduled from elsewhere */
+	void prefer_node(int n)
+	{
+		node.store(n, std::memory_order_relaxed);
+	}
+
+	int get_node() const
+	{
+		return node.load(std::memory_order_relaxed);
+	}
+
+	/* applies to the next time the vthread gets scheduled, see parallel_f::affinity */
+	void set_affinity(parallel_f::affinity a)
+	{
+		affinity = a.key;
+	}
+
+	parallel_f::affinity get_affinity() const
+	{
+		return parallel_f::affinity(affinity);
+	}
+
+	/* token of the task being run, see parallel_f::cancelled() */
+	void set_cancel_token(cancel_token t)
+	{
+		token = t;
+	}
+
+	cancel_token get_cancel_token() const
+	{
+		return token;
+	}
+
 	std::thread::id get_id() const
 	{
 		return thread_id;
 	}
 
+	/* "<name>.<serial>" */
 	std::string get_name() const
 	{
-		return name;
+		return std::string(name) + "." + std::to_string(serial);
+	}
+};
+
+typedef vthread::executor executor;
+
+
+/*
+ * For long running tasks to poll, returns true if the cancel_token of the task being run
+ * by the calling vthread has been cancelled or timed out. Always false outside of managed threads.
+ */
+inline bool cancelled()
+{
+	vthread* t = executor::current_vthread();
+
+	return t && t->get_cancel_token().is_cancelled();
+}
+
+
+/*
+ * For long running tasks to call regularly, e.g. once per loop iteration. Once the task has
+ * run for the quantum (see vthread::set_quantum) and more urgent work is waiting, its vthread
+ * is yielded, suspending its fiber until it gets rescheduled. Most calls only count down a
+ * thread local. Has no effect outside of managed threads.
+ */
+inline void checkpoint()
+{
+	if (--details::checkpoint_countdown > 0)
+		return;
+
+	executor::checkpoint();
+}
+
+
+// parallel_f :: blocking == implementation
+
+/*
+ * Marks a blocking section within a task, e.g. sleeping or file I/O
+ *
+ *     {
+ *         parallel_f::blocking b;
+ *
+ *         image->loadFromFile(filename);
+ *     }
+ *
+ * While it exists, the executor runs a compensating worker (up to its cap), so CPU
+ * bound work is not starved. Has no effect outside of managed threads.
+ */
+class blocking
+{
+private:
+	executor* exec;
+
+public:
+	blocking()
+		:
+		exec(executor::begin_blocking())
+	{
 	}
+
+	~blocking()
+	{
+		if (exec)
+			exec->end_blocking();
+	}
+
+	blocking(const blocking&) = delete;
+	blocking& operator=(const blocking&) = delete;
 };
 
 }
@@ -0,0 +1,158 @@
+// === (C) 2020-2024 === parallel_f / window (tasks, queues, lists in parallel
+// threads) Written by Denis Oliver Kropp <Leichenbegatter@outlook.com>
+
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "log.hpp"
+#include "vthread.hpp"
+
+namespace parallel_f {
+
+/* what task_list::append and task_queue::push do while the window is full */
+enum class backpressure {
+  block, // suspend the calling vthread (or block the thread) until there is room
+  yield  // keep yielding to other vthreads (or threads) until there is room
+};
+
+namespace details {
+
+// parallel_f :: window == implementation
+
+/*
+ * Limit for the tasks in flight, i.e. submitted but not finished yet, by
+ * count and by the cost declared via task_base::set_cost. A single task
+ * exceeding the byte limit is admitted when nothing else is in flight.
+ *
+ * Ids passed on release are collected for the submitter to drop its
+ * references to finished tasks. Those it no longer holds, e.g. after
+ * task_list::finish(), are forgotten and not collected anymore.
+ */
+class window {
+private:
+  std::mutex lock;
+  std::condition_variable cond;
+  size_t max_tasks; // zero for no limit
+  size_t max_bytes; // zero for no limit
+  backpressure mode;
+  size_t tasks;
+  size_t bytes;
+  std::vector<std::shared_ptr<vthread>> waiters;
+  std::vector<unsigned long long> retired;
+  unsigned long long forgotten; // ids up to this one are not collected
+
+public:
+  window(size_t max_tasks, size_t max_bytes, backpressure mode)
+      : max_tasks(max_tasks), max_bytes(max_bytes), mode(mode), tasks(0),
+        bytes(0), forgotten(0) {}
+
+  bool try_acquire(size_t cost) {
+    std::unique_lock<std::mutex> l(lock);
+
+    return take(cost);
+  }
+
+  void acquire(size_t cost) {
+    LOG_DEBUG("window::acquire(%p, %zu) waiting...\n", this, cost);
+
+    bool managed = vthread::is_managed_thread();
+
+    if (mode == backpressure::yield) {
+      while (!try_acquire(cost)) {
+        if (managed)
+          vthread::yield();
+        else
+          std::this_thread::yield();
+      }
+
+      return;
+    }
+
+    if (!managed) {
+      std::unique_lock<std::mutex> l(lock);
+
+      while (!take(cost))
+        vthread::wait(cond, l);
+
+      return;
+    }
+
+    bool taken = false;
+
+    while (!taken) {
+      vthread::suspend([this, cost, &taken](std::shared_ptr<vthread> self) {
+        std::unique_lock<std::mutex> l(lock);
+
+        if (take(cost)) {
+          taken = true;
+          return false;
+        }
+
+        waiters.push_back(self);
+
+        return true;
+      });
+    }
+  }
+
+  void release(size_t cost, unsigned long long id = 0) {
+    std::unique_lock<std::mutex> l(lock);
+
+    tasks--;
+    bytes -= cost;
+
+    if (id > forgotten)
+      retired.push_back(id);
+
+    /* few submitters, let them all retry, keeping the capacity for the next
+     * ones as resuming only schedules them */
+    for (auto &t : waiters)
+      vthread::resume(std::move(t));
+
+    waiters.clear();
+
+    cond.notify_all();
+  }
+
+  /* swaps the ids collected so far into 'ids', whose capacity is reused */
+  void take_retired(std::vector<unsigned long long> &ids) {
+    std::unique_lock<std::mutex> l(lock);
+
+    ids.clear();
+    ids.swap(retired);
+  }
+
+  /* drops the ids collected so far and those up to 'id' released later */
+  void forget(unsigned long long id) {
+    std::unique_lock<std::mutex> l(lock);
+
+    retired.clear();
+
+    forgotten = id;
+  }
+
+private:
+  bool take(size_t cost) {
+    if (tasks) {
+      if (max_tasks && tasks >= max_tasks)
+        return false;
+
+      if (max_bytes && bytes + cost > max_bytes)
+        return false;
+    }
+
+    tasks++;
+    bytes += cost;
+
+    return true;
+  }
+};
+
+} // namespace details
+
+} // namespace parallel_f